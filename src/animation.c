@@ -0,0 +1,207 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * animation.c - frames played over the background
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+/*
+ * Frames built into the binary by genstaticlogo are played one after the
+ * other over the background. Only the first one is drawn whole: every
+ * later frame is the list of rects where it differs from the one before,
+ * so drawing it costs as much as what changed, however large the frames.
+ * All of them come packed in an atlas, converted to the screen format in
+ * one go when the animation starts. Drawing is then copying rows out of
+ * that single buffer.
+ *
+ * A periodic timer ticks at the greatest common divisor of the frame
+ * durations, so a single timerfd serves frames of any length. Ticks missed
+ * while the main loop was busy are caught up by applying the rects of the
+ * frames skipped in a row and flushing once, never by drawing each frame.
+ */
+
+#include "log.h"
+#include "animation.h"
+#include "events.h"
+#include "fb.h"
+#include "pnmtologo.h"
+#include "surface.h"
+#include "util.h"
+
+#include "animation-frames.h"
+
+#include <assert.h>
+
+#define ANIMATION_FRAMES ARRAY_SIZE(dietsplash_animation_deltas)
+
+/* in ms, one for each frame */
+static const unsigned int _durations[] = { ANIMATION_DURATIONS };
+
+static struct {
+    struct ds_fb *fb;
+    struct ds_surface *atlas;
+    /* top left corner of the frames on screen */
+    long x;
+    long y;
+    unsigned int current;
+    unsigned int elapsed;
+    unsigned int period;
+    unsigned int tick;
+} _anim;
+
+static unsigned int _gcd(unsigned int a, unsigned int b)
+{
+    while (b) {
+        unsigned int t = a % b;
+
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/* frames are centered on the background unless given a position on it */
+static void _animation_pos(const struct ds_fb *fb, long w, long h)
+{
+    const struct ds_rect *bg = &fb->bg_area;
+
+#ifdef ANIMATION_X
+    _anim.x = bg->x + ANIMATION_X;
+    _anim.y = bg->y + ANIMATION_Y;
+#else
+    _anim.x = bg->x + (bg->w - w) / 2;
+    _anim.y = bg->y + (bg->h - h) / 2;
+#endif
+}
+
+static void _animation_draw_rect(const struct delta_rect *r)
+{
+    struct ds_rect rect = { r->atlas_x, r->atlas_y, r->width, r->height };
+
+    ds_fb_draw_surface_rect(_anim.fb, _anim.atlas, &rect, _anim.x + r->x,
+                            _anim.y + r->y);
+}
+
+/* turn the frame before @frame on screen into @frame */
+static void _animation_apply(unsigned int frame)
+{
+    const struct delta_frame *d = &dietsplash_animation_deltas[frame];
+    unsigned int i;
+
+    for (i = d->first; i < d->first + d->n_rects; i++)
+        _animation_draw_rect(&dietsplash_animation_rects[i]);
+}
+
+/**
+ * Convert the frames for @fb, show the first one and arm the timer that
+ * moves to the next ones, looping until shutdown. Must be called after the
+ * background is drawn and after ds_events_init().
+ *
+ * @return 0 on success or -1 on error, with nothing drawn
+ */
+int ds_animation_start(struct ds_fb *fb)
+{
+    unsigned int i, n_rects = 0;
+
+    assert(fb);
+    assert(ARRAY_SIZE(_durations) == ANIMATION_FRAMES);
+
+    _anim.fb = fb;
+    _anim.period = 0;
+    _anim.tick = 0;
+
+    for (i = 0; i < ANIMATION_FRAMES; i++) {
+        _anim.period += _durations[i];
+        _anim.tick = _gcd(_anim.tick, _durations[i]);
+        n_rects += dietsplash_animation_deltas[i].n_rects;
+    }
+
+#ifdef BACKGROUND_INDEXED
+    _anim.atlas = ds_surface_new_from_indexed(fb, &dietsplash_animation);
+#else
+    _anim.atlas = ds_surface_new_from_image(fb, &dietsplash_animation);
+#endif
+    if (!_anim.atlas)
+        goto err;
+
+    /* if all frames are the same, the first one is all there is to draw */
+    if (!n_rects) {
+        inf("animation of %zu frames that are all the same", ANIMATION_FRAMES);
+    } else {
+        if (ds_events_timer_add(TIMERS_ANIMATION, _anim.tick / 1000,
+                                (_anim.tick % 1000) * 1000000L, false) == -1)
+            goto err;
+
+        inf("animation of %zu frames, ticking every %ums", ANIMATION_FRAMES,
+            _anim.tick);
+    }
+
+    _anim.current = 0;
+    _anim.elapsed = 0;
+    _animation_pos(fb, dietsplash_animation_first.width,
+                   dietsplash_animation_first.height);
+    _animation_draw_rect(&dietsplash_animation_first);
+    ds_fb_flush(fb);
+
+    return 0;
+
+err:
+    ds_animation_stop();
+    return -1;
+}
+
+/**
+ * Account for @ticks expirations of the animation timer, updating the
+ * screen to the frame that is due now if it's not the one there
+ */
+void ds_animation_tick(uint64_t ticks)
+{
+    unsigned int current = _anim.current;
+    uint64_t elapsed;
+
+    if (!_anim.fb)
+        return;
+
+    /* after a long stall, whole loops are skipped at once */
+    elapsed = (_anim.elapsed + ticks * _anim.tick) % _anim.period;
+
+    while (elapsed >= _durations[current]) {
+        elapsed -= _durations[current];
+        current = (current + 1) % ANIMATION_FRAMES;
+        _animation_apply(current);
+    }
+
+    _anim.elapsed = elapsed;
+
+    if (current == _anim.current)
+        return;
+
+    _anim.current = current;
+    ds_fb_flush(_anim.fb);
+}
+
+void ds_animation_stop(void)
+{
+    ds_surface_free(_anim.atlas);
+    _anim.atlas = NULL;
+    _anim.fb = NULL;
+}
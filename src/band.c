@@ -0,0 +1,240 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * band.c - split row loops across threads
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "log.h"
+#include "band.h"
+#include "util.h"
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BAND_MAX_THREADS 8
+
+/*
+ * src/bench-band measures what it costs to hand bands to the pool and wait
+ * for them, 5us for 2 bands and 15us for 4, and 0.7ns per pixel converted
+ * to xrgb8888, the cheapest job: splitting pays off past 15K to 30K pixels.
+ * A few times that is asked for, as waking a thread on an idle core takes
+ * longer than it did there, on a single CPU. Anything smaller runs on the
+ * caller.
+ */
+#ifndef BAND_MIN_PIXELS
+#define BAND_MIN_PIXELS (128 * 1024)
+#endif
+
+struct band {
+    ds_band_func func;
+    void *data;
+    long start;
+    long end;
+    int ret;
+};
+
+/*
+ * Workers sleep on @work until @job changes, run band number @id if the
+ * job has that many, and the last one to finish wakes the caller on @done
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    pthread_t threads[BAND_MAX_THREADS];
+    long n_threads;
+    struct band bands[BAND_MAX_THREADS];
+    long n_bands;
+    unsigned long job;
+    long pending;
+    bool quit;
+} _pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+static void *_band_thread(void *arg)
+{
+    long id = (long) arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&_pool.lock);
+    for (;;) {
+        while (_pool.job == seen && !_pool.quit)
+            pthread_cond_wait(&_pool.work, &_pool.lock);
+        if (_pool.quit)
+            break;
+
+        seen = _pool.job;
+        if (id < _pool.n_bands) {
+            struct band *band = &_pool.bands[id];
+
+            pthread_mutex_unlock(&_pool.lock);
+            band->ret = band->func(band->data, band->start, band->end);
+            pthread_mutex_lock(&_pool.lock);
+
+            if (--_pool.pending == 0)
+                pthread_cond_signal(&_pool.done);
+        }
+    }
+    pthread_mutex_unlock(&_pool.lock);
+
+    return NULL;
+}
+
+#endif
+
+/**
+ * Number of threads worth starting for a job, 1 if built with
+ * --disable-threads
+ */
+long ds_band_cpus(void)
+{
+#ifdef ENABLE_THREADS
+    static long cpus;
+
+    if (!cpus)
+        cpus = MAX(MIN(sysconf(_SC_NPROCESSORS_ONLN), BAND_MAX_THREADS), 1);
+
+    return cpus;
+#else
+    return 1;
+#endif
+}
+
+/**
+ * Start the threads that take bands of later jobs, so that up to @n bands
+ * run at once: the caller of ds_band_run() takes one of them. Jobs run on
+ * the caller alone if this isn't called or no thread could be started.
+ *
+ * @return number of bands that can run at once
+ */
+long ds_band_init(long n)
+{
+#ifdef ENABLE_THREADS
+    sigset_t all, old;
+    int ret;
+
+    n = MAX(MIN(n, BAND_MAX_THREADS), 1);
+    if (_pool.n_threads)
+        return _pool.n_threads + 1;
+
+    _pool.job = 0;
+    _pool.quit = false;
+
+    /* workers inherit a full mask, so signals keep going to the main thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    for (; _pool.n_threads < n - 1; _pool.n_threads++) {
+        ret = pthread_create(&_pool.threads[_pool.n_threads], NULL,
+                             _band_thread, (void *)(_pool.n_threads + 1));
+        if (ret) {
+            dbg("starting band thread -- %s", strerror(ret));
+            break;
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return _pool.n_threads + 1;
+#else
+    return 1;
+#endif
+}
+
+/**
+ * Stop the threads started by ds_band_init()
+ */
+void ds_band_shutdown(void)
+{
+#ifdef ENABLE_THREADS
+    long i;
+
+    pthread_mutex_lock(&_pool.lock);
+    _pool.quit = true;
+    pthread_cond_broadcast(&_pool.work);
+    pthread_mutex_unlock(&_pool.lock);
+
+    for (i = 0; i < _pool.n_threads; i++)
+        pthread_join(_pool.threads[i], NULL);
+
+    _pool.n_threads = 0;
+#endif
+}
+
+/**
+ * Run @func over @rows rows of @width pixels, split in horizontal bands
+ * handled by the caller and the threads of ds_band_init(). Small jobs, or
+ * all of them if built with --disable-threads, run on the caller in a
+ * single band. Either way every band is done when this returns. Only one
+ * thread may run jobs at a time.
+ *
+ * @return 0 on success or the error of the first band that failed
+ */
+int ds_band_run(long rows, long width, ds_band_func func, void *data)
+{
+#ifdef ENABLE_THREADS
+    struct band *bands = _pool.bands;
+    long i, n;
+
+    n = MIN(_pool.n_threads + 1, rows * width / BAND_MIN_PIXELS);
+    n = MIN(n, rows);
+    if (n < 2)
+        return func(data, 0, rows);
+
+    pthread_mutex_lock(&_pool.lock);
+    for (i = 0; i < n; i++) {
+        bands[i].func = func;
+        bands[i].data = data;
+        bands[i].start = rows * i / n;
+        bands[i].end = rows * (i + 1) / n;
+        bands[i].ret = 0;
+    }
+    _pool.n_bands = n;
+    _pool.pending = n - 1;
+    _pool.job++;
+    pthread_cond_broadcast(&_pool.work);
+    pthread_mutex_unlock(&_pool.lock);
+
+    /* the first band is ours */
+    bands[0].ret = func(data, bands[0].start, bands[0].end);
+
+    pthread_mutex_lock(&_pool.lock);
+    while (_pool.pending)
+        pthread_cond_wait(&_pool.done, &_pool.lock);
+    pthread_mutex_unlock(&_pool.lock);
+
+    for (i = 0; i < n; i++)
+        if (bands[i].ret)
+            return bands[i].ret;
+
+    return 0;
+#else
+    return func(data, 0, rows);
+#endif
+}
@@ -0,0 +1,42 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * band.h - split row loops across threads
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#ifndef __DIETSPLASH_BAND_H
+#define __DIETSPLASH_BAND_H
+
+/*
+ * Process rows [@start, @end) of a job. Bands of the same job may run
+ * concurrently, so they must only write to their own rows.
+ *
+ * @return 0 on success or a negative errno
+ */
+typedef int (*ds_band_func)(void *data, long start, long end);
+
+long ds_band_init(long n);
+void ds_band_shutdown(void);
+int ds_band_run(long rows, long width, ds_band_func func, void *data);
+long ds_band_cpus(void);
+
+#endif
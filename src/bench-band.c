@@ -0,0 +1,199 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * bench-band.c - time jobs split in bands against running them whole
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "band.h"
+#include "blit.h"
+#include "fb.h"
+#include "log.h"
+#include "pnmtologo.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Built with BAND_MIN_PIXELS at 1, so every job is split in as many bands
+ * as the pool takes. It prints what it costs to hand a job to the pool,
+ * and to start and join a thread for comparison, then how long converting
+ * images of growing size to xrgb8888 takes whole and in bands. The pixel
+ * count past which a second band pays for its handoff is what
+ * BAND_MIN_PIXELS in src/band.c should be a few times of.
+ *
+ * Usage: bench-band [max threads]
+ */
+
+#define WIDTH 1024
+#define MAX_ROWS 4096
+
+struct convert_job {
+    const struct ds_fb *fb;
+    const struct color *src;
+    char *dst;
+};
+
+static int _convert_band(void *data, long start, long end)
+{
+    const struct convert_job *job = data;
+    long j;
+
+    for (j = start; j < end; j++)
+        job->fb->blit_row(job->fb, job->dst + j * WIDTH * 4,
+                          job->src + j * WIDTH, WIDTH, j);
+
+    return 0;
+}
+
+static int _empty_band(void *data, long start, long end)
+{
+    return 0;
+}
+
+static void *_empty_thread(void *arg)
+{
+    return NULL;
+}
+
+static double _now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* best of a few rounds of enough calls to take some milliseconds */
+static double _time_job(long rows, long width, ds_band_func func, void *data)
+{
+    double best = 1e9, t;
+    long i, round, calls;
+
+    calls = MIN(MAX(1, 16 * 1024 * 1024 / (rows * width)), 1000);
+    for (round = 0; round < 5; round++) {
+        t = _now();
+        for (i = 0; i < calls; i++)
+            ds_band_run(rows, width, func, data);
+        t = (_now() - t) / calls;
+        best = MIN(best, t);
+    }
+
+    return best;
+}
+
+static double _time_spawn(void)
+{
+    pthread_t thread;
+    double t;
+    long i;
+
+    t = _now();
+    for (i = 0; i < 1000; i++) {
+        if (pthread_create(&thread, NULL, _empty_thread, NULL)) {
+            fprintf(stderr, "can't start a thread\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_join(thread, NULL);
+    }
+
+    return (_now() - t) / 1000;
+}
+
+int main(int argc, char *argv[])
+{
+    struct convert_job job;
+    struct ds_fb fb;
+    struct color *src;
+    double whole, handoff, per_pixel;
+    long max_threads, threads, rows, i;
+
+    ds_log_init(argv[0]);
+
+    max_threads = argc > 1 ? atol(argv[1]) : MAX(ds_band_cpus(), 4);
+    max_threads = MAX(max_threads, 2);
+
+    memset(&fb, 0, sizeof(fb));
+    ds_blit_format_fill(&fb, DS_FB_FORMAT_XRGB8888);
+    fb.blit_row = ds_blit_row_func_get(&fb);
+
+    src = malloc(MAX_ROWS * WIDTH * sizeof(*src));
+    job.dst = malloc(MAX_ROWS * WIDTH * 4);
+    if (!src || !job.dst) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < MAX_ROWS * WIDTH; i++) {
+        src[i].red = rand();
+        src[i].green = rand();
+        src[i].blue = rand();
+    }
+    job.fb = &fb;
+    job.src = src;
+
+    printf("%ld CPUs\n", ds_band_cpus());
+    printf("thread start and join: %.1fus\n", _time_spawn() * 1e6);
+
+    ds_band_init(1);
+    whole = _time_job(MAX_ROWS, WIDTH, _convert_band, &job);
+    per_pixel = whole / (MAX_ROWS * WIDTH);
+    printf("conversion: %.2fns per pixel\n", per_pixel * 1e9);
+
+    for (threads = 2; threads <= max_threads; threads++) {
+        ds_band_shutdown();
+        if (ds_band_init(threads) != threads) {
+            fprintf(stderr, "can't start %ld threads\n", threads);
+            break;
+        }
+
+        handoff = _time_job(threads, 1, _empty_band, NULL);
+        printf("\n%ld bands: handoff %.1fus, pays off past %.0fK pixels\n",
+               threads, handoff * 1e6,
+               handoff / (per_pixel * (threads - 1) / threads) / 1024);
+        printf("%10s %12s %12s %8s\n", "pixels", "whole (us)", "bands (us)",
+               "speedup");
+
+        for (rows = 16; rows <= MAX_ROWS; rows *= 2) {
+            double banded;
+
+            ds_band_shutdown();
+            ds_band_init(1);
+            whole = _time_job(rows, WIDTH, _convert_band, &job);
+            ds_band_shutdown();
+            ds_band_init(threads);
+            banded = _time_job(rows, WIDTH, _convert_band, &job);
+
+            printf("%9ldK %12.1f %12.1f %8.2f\n", rows * WIDTH / 1024,
+                   whole * 1e6, banded * 1e6, whole / banded);
+        }
+    }
+
+    ds_band_shutdown();
+    free(src);
+    free(job.dst);
+    ds_log_shutdown();
+
+    return EXIT_SUCCESS;
+}
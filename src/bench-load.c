@@ -0,0 +1,148 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * bench-load.c - time loading images from a cold and a warm page cache
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "pnmtologo.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Times ds_read_image() on each file given, e.g. the same background as PPM
+ * and as PNG, and prints the median of a few runs. Cold runs evict the file
+ * from the page cache with posix_fadvise(POSIX_FADV_DONTNEED) first, as if
+ * it was read for the first time at boot; warm runs read it again as is.
+ *
+ * Usage: bench-load file...
+ */
+
+#define RUNS 11
+
+static double _now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int _evict(const char *filename)
+{
+    int fd, ret;
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    /* only clean pages are dropped */
+    fdatasync(fd);
+    ret = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+
+    return ret ? -1 : 0;
+}
+
+static int _cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * Median time to load @filename in seconds, or a negative number if it
+ * can't be read
+ */
+static double _time_load(const char *filename, bool cold,
+                         unsigned int *width, unsigned int *height)
+{
+    double t[RUNS], start;
+    struct image *img;
+    int i;
+
+    for (i = 0; i < RUNS; i++) {
+        if (cold && _evict(filename) < 0)
+            return -1;
+
+        start = _now();
+        img = ds_read_image(filename);
+        t[i] = _now() - start;
+
+        if (!img)
+            return -1;
+
+        *width = img->width;
+        *height = img->height;
+        free(img);
+    }
+
+    qsort(t, RUNS, sizeof(t[0]), _cmp_double);
+
+    return t[RUNS / 2];
+}
+
+int main(int argc, char *argv[])
+{
+    int i, ret = EXIT_SUCCESS;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s file...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%11s %9s %9s %9s  %s\n", "pixels", "size", "cold", "warm", "image");
+
+    for (i = 1; i < argc; i++) {
+        unsigned int width = 0, height = 0;
+        double cold, warm;
+        struct stat st;
+        char pixels[32];
+
+        if (stat(argv[i], &st) < 0) {
+            perror(argv[i]);
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        cold = _time_load(argv[i], true, &width, &height);
+        warm = _time_load(argv[i], false, &width, &height);
+        if (cold < 0 || warm < 0) {
+            fprintf(stderr, "%s: can't be loaded\n", argv[i]);
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        snprintf(pixels, sizeof(pixels), "%ux%u", width, height);
+        printf("%11s %7.1fKB %7.1fms %7.1fms  %s\n", pixels,
+               st.st_size / 1024.0, cold * 1e3, warm * 1e3, argv[i]);
+    }
+
+    return ret;
+}
@@ -0,0 +1,224 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * bench-pnm.c - time parsing of plain PNM against the stdio parser it replaced
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "pnmtologo.h"
+#include "util.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Times ds_read_image() on a plain PGM or PPM against the parser it
+ * replaced, which went through stdio a character at a time, and checks
+ * both give the same pixels. Without a file, a 1920x1080 PPM of random
+ * samples is written the way pnmtoplainpnm does and used instead.
+ *
+ * Usage: bench-pnm [file.ppm]
+ */
+
+#define GEN_WIDTH 1920
+#define GEN_HEIGHT 1080
+#define RUNS 10
+
+static double _now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the old parser, minus dying on errors */
+static unsigned int _stdio_number(FILE *fp)
+{
+    int c, val;
+
+    do {
+        c = fgetc(fp);
+        if (c == EOF)
+            return 0;
+        if (c == '#') {
+            do {
+                c = fgetc(fp);
+                if (c == EOF)
+                    return 0;
+            } while (c != '\n');
+        }
+    } while (isspace(c));
+
+    val = 0;
+    while (isdigit(c)) {
+        val = 10 * val + c - '0';
+        c = fgetc(fp);
+        if (c == EOF)
+            break;
+    }
+
+    return val;
+}
+
+static unsigned int _stdio_number255(FILE *fp, unsigned int maxval)
+{
+    unsigned int val = _stdio_number(fp);
+
+    return (255 * val + (maxval / 2)) / maxval;
+}
+
+static struct image *_stdio_read(const char *filename)
+{
+    struct image *img;
+    unsigned int width, height, maxval;
+    size_t i, n;
+    FILE *fp;
+    int magic;
+
+    fp = fopen(filename, "r");
+    if (!fp)
+        return NULL;
+
+    if (fgetc(fp) != 'P' || ((magic = fgetc(fp)) != '2' && magic != '3')) {
+        fclose(fp);
+        return NULL;
+    }
+
+    width = _stdio_number(fp);
+    height = _stdio_number(fp);
+    maxval = _stdio_number(fp);
+    n = (size_t) width * height;
+
+    img = malloc(sizeof(*img) + n * sizeof(struct color));
+    if (!img || !maxval) {
+        free(img);
+        fclose(fp);
+        return NULL;
+    }
+
+    img->width = width;
+    img->height = height;
+
+    for (i = 0; i < n; i++) {
+        if (magic == '3') {
+            img->pixels[i].red = _stdio_number255(fp, maxval);
+            img->pixels[i].green = _stdio_number255(fp, maxval);
+            img->pixels[i].blue = _stdio_number255(fp, maxval);
+        } else {
+            img->pixels[i].red = img->pixels[i].green =
+                img->pixels[i].blue = _stdio_number255(fp, maxval);
+        }
+    }
+
+    fclose(fp);
+
+    return img;
+}
+
+static int _generate(char *filename)
+{
+    FILE *fp;
+    long i;
+    int fd;
+
+    fd = mkstemp(filename);
+    if (fd < 0)
+        return -1;
+
+    fp = fdopen(fd, "w");
+    if (!fp) {
+        close(fd);
+        return -1;
+    }
+
+    /* at most 70 characters per line, as the netpbm tools do */
+    fprintf(fp, "P3\n# random samples\n%d %d\n255\n", GEN_WIDTH, GEN_HEIGHT);
+    for (i = 0; i < (long) GEN_WIDTH * GEN_HEIGHT; i++)
+        fprintf(fp, "%d %d %d%c", rand() & 255, rand() & 255, rand() & 255,
+                i % 4 == 3 ? '\n' : ' ');
+
+    return fclose(fp);
+}
+
+int main(int argc, char *argv[])
+{
+    char generated[] = "/tmp/bench-pnm-XXXXXX";
+    const char *filename = argv[1];
+    struct image *want, *got;
+    double t_stdio, t_map, t;
+    int i, ret = EXIT_SUCCESS;
+
+    if (!filename) {
+        if (_generate(generated) < 0) {
+            perror("writing test image");
+            return EXIT_FAILURE;
+        }
+        filename = generated;
+    }
+
+    /* best of a few each, the file is in the page cache after the first */
+    t_stdio = 1e9;
+    want = NULL;
+    for (i = 0; i < RUNS; i++) {
+        free(want);
+        t = _now();
+        want = _stdio_read(filename);
+        t_stdio = MIN(t_stdio, _now() - t);
+    }
+
+    t_map = 1e9;
+    got = NULL;
+    for (i = 0; i < RUNS; i++) {
+        free(got);
+        t = _now();
+        got = ds_read_image(filename);
+        t_map = MIN(t_map, _now() - t);
+    }
+
+    if (!want || !got) {
+        fprintf(stderr, "%s: not a plain PGM or PPM, or malformed\n",
+                filename);
+        ret = EXIT_FAILURE;
+    } else {
+        printf("%ux%u\n", got->width, got->height);
+        printf("stdio: %8.1fms\n", t_stdio * 1e3);
+        printf("mapped: %7.1fms, %.1fx\n", t_map * 1e3, t_stdio / t_map);
+
+        if (want->width != got->width || want->height != got->height ||
+            memcmp(want->pixels, got->pixels,
+                   (size_t) got->width * got->height * sizeof(struct color))) {
+            fprintf(stderr, "pixels differ\n");
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    free(want);
+    free(got);
+    if (filename == generated)
+        unlink(generated);
+
+    return ret;
+}
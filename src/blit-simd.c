@@ -0,0 +1,529 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * blit-simd.c - vectorized conversion of image rows, selected at runtime
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "log.h"
+#include "blit.h"
+#include "fb.h"
+#include "pnmtologo.h"
+#include "util.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Going from 24 to 32bpp, or turning 24bpp pixels around, is a byte
+ * shuffle, which is exactly what SSSE3/AVX2/NEON are good at. Plain SSE2,
+ * which every x86-64 CPU has, has no byte shuffle: pixels are moved to a
+ * word each by shifting the whole register instead.
+ *
+ * 16bpp formats are quantized with the ordered dither of the scalar
+ * tables, computed on 16-bit lanes. For the dither threshold d of a pixel
+ * the tables hold (32 * v * maxval + 255 * (2d + 1)) / (255 * 32), which
+ * is (v * maxval + c) / 255 with c = 255 * (2d + 1) / 32 rounded down,
+ * since v * maxval is an integer. Dividing by 255 numbers below 2^16 is
+ * taking the high half of a multiplication by 0x8081, shifted by 7.
+ *
+ * Every routine must give exactly what its scalar counterpart does, which
+ * src/test-blit checks on 'make check'.
+ */
+
+static inline uint32_t _xrgb8888(const struct color *c)
+{
+    return (uint32_t) c->red << 16 | c->green << 8 | c->blue;
+}
+
+static inline uint32_t _bgrx8888(const struct color *c)
+{
+    return (uint32_t) c->blue << 24 | c->green << 16 | c->red << 8;
+}
+
+/* what the dither tables of blit.c hold for @v at threshold @d */
+static inline unsigned int _quantize(unsigned int v, int length,
+                                     unsigned int d)
+{
+    unsigned int maxval = (1 << length) - 1;
+
+    return (v * maxval * 32 + (2 * d + 1) * 255) / (255 * 32);
+}
+
+static inline uint16_t _pixel565(const struct ds_fb *fb,
+                                 const struct color *c, unsigned int d)
+{
+    return _quantize(c->red, fb->red_length, d) << fb->red_offset |
+           _quantize(c->green, fb->green_length, d) << fb->green_offset |
+           _quantize(c->blue, fb->blue_length, d) << fb->blue_offset;
+}
+
+/* c of each column of row @y */
+static inline void _thresholds(long y, uint16_t threshold[4])
+{
+    int x;
+
+    for (x = 0; x < 4; x++)
+        threshold[x] = 255 * (2 * ds_blit_dither4x4[y & 3][x] + 1) / 32;
+}
+
+#if defined(ENABLE_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+#define SHUFFLE_XRGB8888 \
+    2, 1, 0, 0x80, 5, 4, 3, 0x80, 8, 7, 6, 0x80, 11, 10, 9, 0x80
+#define SHUFFLE_BGRX8888 \
+    0x80, 0, 1, 2, 0x80, 3, 4, 5, 0x80, 6, 7, 8, 0x80, 9, 10, 11
+#define SHUFFLE_RGB888 \
+    2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15
+
+/*
+ * Channel @k of 8 pixels, in 16-bit lanes: the first 5 come from a load at
+ * the start of the pixels, the last 3 from one 8 bytes further
+ */
+#define SHUFFLE_565_LOW(_k) \
+    _k, 0x80, 3 + _k, 0x80, 6 + _k, 0x80, 9 + _k, 0x80, 12 + _k, 0x80, \
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80
+#define SHUFFLE_565_HIGH(_k) \
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, \
+    7 + _k, 0x80, 10 + _k, 0x80, 13 + _k, 0x80
+
+static bool _cpu_sse2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+static bool _cpu_ssse3(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+
+static bool _cpu_avx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+/*
+ * The 4 pixels of a load, plus 4 bytes of garbage, as one word each. The
+ * load covers 16 bytes, so the loops stop with more than 5 pixels left.
+ */
+__attribute__((target("sse2")))
+static inline __m128i _spread_sse2(const unsigned char *s)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *) s);
+
+    return _mm_unpacklo_epi64(
+        _mm_unpacklo_epi32(x, _mm_srli_si128(x, 3)),
+        _mm_unpacklo_epi32(_mm_srli_si128(x, 6), _mm_srli_si128(x, 9)));
+}
+
+__attribute__((target("sse2")))
+static void _blit_row_xrgb8888_sse2(const struct ds_fb *fb, char *dst,
+                                    const struct color *src, long n, long y)
+{
+    const __m128i red = _mm_set1_epi32(0xff), green = _mm_set1_epi32(0xff00);
+    const unsigned char *s = (const unsigned char *) src;
+    uint32_t *p = (uint32_t *) dst;
+    long i;
+
+    for (i = 0; i + 6 <= n; i += 4) {
+        __m128i v = _spread_sse2(s + i * 3);
+        __m128i r = _mm_slli_epi32(_mm_and_si128(v, red), 16);
+        __m128i g = _mm_and_si128(v, green);
+        __m128i b = _mm_and_si128(_mm_srli_epi32(v, 16), red);
+
+        _mm_storeu_si128((__m128i *)(p + i),
+                         _mm_or_si128(_mm_or_si128(r, g), b));
+    }
+
+    for (; i < n; i++)
+        p[i] = _xrgb8888(&src[i]);
+}
+
+__attribute__((target("sse2")))
+static void _blit_row_bgrx8888_sse2(const struct ds_fb *fb, char *dst,
+                                    const struct color *src, long n, long y)
+{
+    const unsigned char *s = (const unsigned char *) src;
+    uint32_t *p = (uint32_t *) dst;
+    long i;
+
+    /* the garbage byte is shifted out */
+    for (i = 0; i + 6 <= n; i += 4)
+        _mm_storeu_si128((__m128i *)(p + i),
+                         _mm_slli_epi32(_spread_sse2(s + i * 3), 8));
+
+    for (; i < n; i++)
+        p[i] = _bgrx8888(&src[i]);
+}
+
+/*
+ * Each 16-byte load covers 4 pixels plus 4 bytes of the next one, so the
+ * vector loop stops while there are still pixels ahead to make sure we
+ * never read past the end of the row.
+ */
+#define DEFINE_SSSE3(_name, _mask)                                          \
+__attribute__((target("ssse3")))                                            \
+static void _blit_row_##_name##_ssse3(const struct ds_fb *fb, char *dst,    \
+                                      const struct color *src, long n,      \
+                                      long y)                               \
+{                                                                           \
+    const __m128i mask = _mm_setr_epi8(_mask);                              \
+    const unsigned char *s = (const unsigned char *) src;                   \
+    uint32_t *p = (uint32_t *) dst;                                         \
+    long i;                                                                 \
+                                                                            \
+    for (i = 0; i + 10 <= n; i += 8) {                                      \
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i * 3));          \
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i * 3 + 12));     \
+        _mm_storeu_si128((__m128i *)(p + i), _mm_shuffle_epi8(a, mask));    \
+        _mm_storeu_si128((__m128i *)(p + i + 4), _mm_shuffle_epi8(b, mask));\
+    }                                                                       \
+                                                                            \
+    for (; i < n; i++)                                                      \
+        p[i] = _##_name(&src[i]);                                           \
+}
+
+#define DEFINE_AVX2(_name, _mask)                                           \
+__attribute__((target("avx2")))                                             \
+static void _blit_row_##_name##_avx2(const struct ds_fb *fb, char *dst,     \
+                                     const struct color *src, long n,       \
+                                     long y)                                \
+{                                                                           \
+    const __m256i mask = _mm256_setr_epi8(_mask, _mask);                    \
+    const unsigned char *s = (const unsigned char *) src;                   \
+    uint32_t *p = (uint32_t *) dst;                                         \
+    long i;                                                                 \
+                                                                            \
+    for (i = 0; i + 18 <= n; i += 16) {                                     \
+        __m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(         \
+            _mm_loadu_si128((const __m128i *)(s + i * 3))),                 \
+            _mm_loadu_si128((const __m128i *)(s + i * 3 + 12)), 1);         \
+        __m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(         \
+            _mm_loadu_si128((const __m128i *)(s + i * 3 + 24))),            \
+            _mm_loadu_si128((const __m128i *)(s + i * 3 + 36)), 1);         \
+        _mm256_storeu_si256((__m256i *)(p + i),                             \
+                            _mm256_shuffle_epi8(a, mask));                  \
+        _mm256_storeu_si256((__m256i *)(p + i + 8),                         \
+                            _mm256_shuffle_epi8(b, mask));                  \
+    }                                                                       \
+                                                                            \
+    for (; i < n; i++)                                                      \
+        p[i] = _##_name(&src[i]);                                           \
+}
+
+DEFINE_SSSE3(xrgb8888, SHUFFLE_XRGB8888)
+DEFINE_SSSE3(bgrx8888, SHUFFLE_BGRX8888)
+DEFINE_AVX2(xrgb8888, SHUFFLE_XRGB8888)
+DEFINE_AVX2(bgrx8888, SHUFFLE_BGRX8888)
+
+/*
+ * 5 pixels turned around per load. The 16th byte stored belongs to the
+ * next pixel and is written again by the next store.
+ */
+__attribute__((target("ssse3")))
+static void _blit_row_rgb888_ssse3(const struct ds_fb *fb, char *dst,
+                                   const struct color *src, long n, long y)
+{
+    const __m128i mask = _mm_setr_epi8(SHUFFLE_RGB888);
+    const unsigned char *s = (const unsigned char *) src;
+    unsigned char *d = (unsigned char *) dst;
+    long i;
+
+    for (i = 0; i + 6 <= n; i += 5)
+        _mm_storeu_si128((__m128i *)(d + i * 3), _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i *)(s + i * 3)), mask));
+
+    for (; i < n; i++) {
+        d[i * 3] = src[i].blue;
+        d[i * 3 + 1] = src[i].green;
+        d[i * 3 + 2] = src[i].red;
+    }
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i _quantize_ssse3(__m128i v, __m128i maxval,
+                                      __m128i offset, __m128i threshold)
+{
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(v, maxval), threshold);
+
+    t = _mm_srli_epi16(_mm_mulhi_epu16(t, _mm_set1_epi16(0x8081)), 7);
+
+    return _mm_sll_epi16(t, offset);
+}
+
+#define CHANNEL_SSSE3(_lo, _hi, _k)                                         \
+    _mm_or_si128(_mm_shuffle_epi8(_lo, _mm_setr_epi8(SHUFFLE_565_LOW(_k))), \
+                 _mm_shuffle_epi8(_hi, _mm_setr_epi8(SHUFFLE_565_HIGH(_k))))
+
+__attribute__((target("ssse3")))
+static void _blit_row_565_ssse3(const struct ds_fb *fb, char *dst,
+                                const struct color *src, long n, long y)
+{
+    const unsigned char *dither = ds_blit_dither4x4[y & 3];
+    const unsigned char *s = (const unsigned char *) src;
+    /* loaded once, stores to dst may alias fb */
+    const __m128i maxval[3] = {
+        _mm_set1_epi16((1 << fb->red_length) - 1),
+        _mm_set1_epi16((1 << fb->green_length) - 1),
+        _mm_set1_epi16((1 << fb->blue_length) - 1),
+    };
+    const __m128i offset[3] = {
+        _mm_cvtsi32_si128(fb->red_offset),
+        _mm_cvtsi32_si128(fb->green_offset),
+        _mm_cvtsi32_si128(fb->blue_offset),
+    };
+    uint16_t *p = (uint16_t *) dst, t[4];
+    __m128i threshold;
+    long i;
+
+    _thresholds(y, t);
+    threshold = _mm_setr_epi16(t[0], t[1], t[2], t[3], t[0], t[1], t[2], t[3]);
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(s + i * 3));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(s + i * 3 + 8));
+        __m128i r = _quantize_ssse3(CHANNEL_SSSE3(lo, hi, 0), maxval[0],
+                                    offset[0], threshold);
+        __m128i g = _quantize_ssse3(CHANNEL_SSSE3(lo, hi, 1), maxval[1],
+                                    offset[1], threshold);
+        __m128i b = _quantize_ssse3(CHANNEL_SSSE3(lo, hi, 2), maxval[2],
+                                    offset[2], threshold);
+
+        _mm_storeu_si128((__m128i *)(p + i),
+                         _mm_or_si128(_mm_or_si128(r, g), b));
+    }
+
+    for (; i < n; i++)
+        p[i] = _pixel565(fb, &src[i], dither[i & 3]);
+}
+
+/* best ones first */
+static const struct ds_blit_kernel _kernels[] = {
+    { "AVX2", DS_FB_FORMAT_XRGB8888, _blit_row_xrgb8888_avx2, _cpu_avx2 },
+    { "AVX2", DS_FB_FORMAT_BGRX8888, _blit_row_bgrx8888_avx2, _cpu_avx2 },
+    { "SSSE3", DS_FB_FORMAT_XRGB8888, _blit_row_xrgb8888_ssse3, _cpu_ssse3 },
+    { "SSSE3", DS_FB_FORMAT_BGRX8888, _blit_row_bgrx8888_ssse3, _cpu_ssse3 },
+    { "SSSE3", DS_FB_FORMAT_RGB888, _blit_row_rgb888_ssse3, _cpu_ssse3 },
+    { "SSSE3", DS_FB_FORMAT_RGB565, _blit_row_565_ssse3, _cpu_ssse3 },
+    { "SSSE3", DS_FB_FORMAT_BGR565, _blit_row_565_ssse3, _cpu_ssse3 },
+    { "SSE2", DS_FB_FORMAT_XRGB8888, _blit_row_xrgb8888_sse2, _cpu_sse2 },
+    { "SSE2", DS_FB_FORMAT_BGRX8888, _blit_row_bgrx8888_sse2, _cpu_sse2 },
+};
+
+#elif defined(ENABLE_SIMD) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#if defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+static bool _cpu_neon(void)
+{
+#if defined(__arm__)
+    /* the kernel may still have NEON disabled */
+    return getauxval(AT_HWCAP) & HWCAP_NEON;
+#else
+    return true;
+#endif
+}
+
+static void _blit_row_xrgb8888_neon(const struct ds_fb *fb, char *dst,
+                                    const struct color *src, long n, long y)
+{
+    const unsigned char *s = (const unsigned char *) src;
+    unsigned char *d = (unsigned char *) dst;
+    uint8x16x4_t out;
+    long i;
+
+    out.val[3] = vdupq_n_u8(0);
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16x3_t in = vld3q_u8(s + i * 3);
+        out.val[0] = in.val[2];
+        out.val[1] = in.val[1];
+        out.val[2] = in.val[0];
+        vst4q_u8(d + i * 4, out);
+    }
+
+    for (; i < n; i++) {
+        d[i * 4] = src[i].blue;
+        d[i * 4 + 1] = src[i].green;
+        d[i * 4 + 2] = src[i].red;
+        d[i * 4 + 3] = 0;
+    }
+}
+
+static void _blit_row_bgrx8888_neon(const struct ds_fb *fb, char *dst,
+                                    const struct color *src, long n, long y)
+{
+    const unsigned char *s = (const unsigned char *) src;
+    unsigned char *d = (unsigned char *) dst;
+    uint8x16x4_t out;
+    long i;
+
+    out.val[0] = vdupq_n_u8(0);
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16x3_t in = vld3q_u8(s + i * 3);
+        out.val[1] = in.val[0];
+        out.val[2] = in.val[1];
+        out.val[3] = in.val[2];
+        vst4q_u8(d + i * 4, out);
+    }
+
+    for (; i < n; i++) {
+        d[i * 4] = 0;
+        d[i * 4 + 1] = src[i].red;
+        d[i * 4 + 2] = src[i].green;
+        d[i * 4 + 3] = src[i].blue;
+    }
+}
+
+static void _blit_row_rgb888_neon(const struct ds_fb *fb, char *dst,
+                                  const struct color *src, long n, long y)
+{
+    const unsigned char *s = (const unsigned char *) src;
+    unsigned char *d = (unsigned char *) dst;
+    long i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16x3_t in = vld3q_u8(s + i * 3);
+        uint8x16_t red = in.val[0];
+
+        in.val[0] = in.val[2];
+        in.val[2] = red;
+        vst3q_u8(d + i * 3, in);
+    }
+
+    for (; i < n; i++) {
+        d[i * 3] = src[i].blue;
+        d[i * 3 + 1] = src[i].green;
+        d[i * 3 + 2] = src[i].red;
+    }
+}
+
+static inline uint16x8_t _quantize_neon(uint8x8_t v, uint8x8_t maxval,
+                                        int16x8_t offset, uint16x8_t threshold)
+{
+    uint16x8_t t = vaddq_u16(vmull_u8(v, maxval), threshold);
+
+    /* NEON has no high half of 16-bit products, but this is t / 255 too */
+    t = vshrq_n_u16(vaddq_u16(vaddq_u16(t, vdupq_n_u16(1)),
+                              vshrq_n_u16(t, 8)), 8);
+
+    return vshlq_u16(t, offset);
+}
+
+static void _blit_row_565_neon(const struct ds_fb *fb, char *dst,
+                               const struct color *src, long n, long y)
+{
+    const unsigned char *dither = ds_blit_dither4x4[y & 3];
+    const unsigned char *s = (const unsigned char *) src;
+    /* loaded once, stores to dst may alias fb */
+    const uint8x8_t maxval[3] = {
+        vdup_n_u8((1 << fb->red_length) - 1),
+        vdup_n_u8((1 << fb->green_length) - 1),
+        vdup_n_u8((1 << fb->blue_length) - 1),
+    };
+    const int16x8_t offset[3] = {
+        vdupq_n_s16(fb->red_offset),
+        vdupq_n_s16(fb->green_offset),
+        vdupq_n_s16(fb->blue_offset),
+    };
+    uint16_t *p = (uint16_t *) dst, t[8];
+    uint16x8_t threshold;
+    long i, h, k;
+
+    _thresholds(y, t);
+    _thresholds(y, t + 4);
+    threshold = vld1q_u16(t);
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16x3_t in = vld3q_u8(s + i * 3);
+
+        for (h = 0; h < 2; h++) {
+            uint16x8_t out = vdupq_n_u16(0);
+
+            for (k = 0; k < 3; k++) {
+                uint8x8_t v = h ? vget_high_u8(in.val[k])
+                                : vget_low_u8(in.val[k]);
+
+                out = vorrq_u16(out, _quantize_neon(v, maxval[k], offset[k],
+                                                    threshold));
+            }
+
+            vst1q_u16(p + i + h * 8, out);
+        }
+    }
+
+    for (; i < n; i++)
+        p[i] = _pixel565(fb, &src[i], dither[i & 3]);
+}
+
+static const struct ds_blit_kernel _kernels[] = {
+    { "NEON", DS_FB_FORMAT_XRGB8888, _blit_row_xrgb8888_neon, _cpu_neon },
+    { "NEON", DS_FB_FORMAT_BGRX8888, _blit_row_bgrx8888_neon, _cpu_neon },
+    { "NEON", DS_FB_FORMAT_RGB888, _blit_row_rgb888_neon, _cpu_neon },
+    { "NEON", DS_FB_FORMAT_RGB565, _blit_row_565_neon, _cpu_neon },
+    { "NEON", DS_FB_FORMAT_BGR565, _blit_row_565_neon, _cpu_neon },
+};
+
+#endif
+
+#if defined(ENABLE_SIMD) && \
+    (defined(__x86_64__) || defined(__i386__) || defined(__ARM_NEON))
+/**
+ * Every vectorized routine built in for this architecture, whether this
+ * CPU can run it or not, the best one of each format first
+ */
+const struct ds_blit_kernel *ds_blit_simd_kernels(unsigned int *n)
+{
+    *n = ARRAY_SIZE(_kernels);
+    return _kernels;
+}
+#else
+const struct ds_blit_kernel *ds_blit_simd_kernels(unsigned int *n)
+{
+    *n = 0;
+    return NULL;
+}
+#endif
+
+ds_blit_row_func ds_blit_simd_row_func_get(enum ds_fb_format format)
+{
+    const struct ds_blit_kernel *kernels;
+    unsigned int i, n;
+
+    kernels = ds_blit_simd_kernels(&n);
+
+    for (i = 0; i < n; i++) {
+        if (kernels[i].format == format && kernels[i].supported()) {
+            inf("using %s blitter", kernels[i].name);
+            return kernels[i].func;
+        }
+    }
+
+    return NULL;
+}
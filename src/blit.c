@@ -0,0 +1,525 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * blit.c - conversion of image rows to framebuffer pixel formats
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "blit.h"
+#include "fb.h"
+#include "pnmtologo.h"
+#include "util.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+static const struct {
+    enum ds_fb_format format;
+    const char *name;
+    int bits_per_pixel;
+    int red_length, red_offset;
+    int green_length, green_offset;
+    int blue_length, blue_offset;
+} _formats[] = {
+    { DS_FB_FORMAT_XRGB8888, "XRGB8888", 32, 8, 16, 8, 8, 8, 0 },
+    { DS_FB_FORMAT_BGRX8888, "BGRX8888", 32, 8, 8, 8, 16, 8, 24 },
+    { DS_FB_FORMAT_RGB888, "RGB888", 24, 8, 16, 8, 8, 8, 0 },
+    { DS_FB_FORMAT_RGB565, "RGB565", 16, 5, 11, 6, 5, 5, 0 },
+    { DS_FB_FORMAT_BGR565, "BGR565", 16, 5, 0, 6, 5, 5, 11 },
+    { DS_FB_FORMAT_RGB332, "RGB332", 8, 3, 5, 3, 2, 2, 0 },
+};
+
+/*
+ * Fallback for layouts we don't know about: compute each pixel from the
+ * channel description and write it one byte at a time
+ */
+static void _blit_row_generic(const struct ds_fb *fb, char *dst,
+                              const struct color *src, long n, long y)
+{
+    int k, bytes_per_pixel = fb->bits_per_pixel / 8;
+    long i;
+
+    for (i = 0; i < n; i++) {
+        long pixel = ((src[i].blue >> (8 - fb->blue_length)) << fb->blue_offset) |
+                     ((src[i].green >> (8 - fb->green_length)) << fb->green_offset) |
+                     ((src[i].red >> (8 - fb->red_length)) << fb->red_offset);
+
+        for (k = 0; k < bytes_per_pixel; k++)
+            *dst++ = pixel >> k * 8;
+    }
+}
+
+static void _blit_row_xrgb8888(const struct ds_fb *fb, char *dst,
+                               const struct color *src, long n, long y)
+{
+    uint32_t *p = (uint32_t *) dst;
+    long i;
+
+    for (i = 0; i < n; i++)
+        p[i] = (uint32_t) src[i].red << 16 | src[i].green << 8 | src[i].blue;
+}
+
+static void _blit_row_bgrx8888(const struct ds_fb *fb, char *dst,
+                               const struct color *src, long n, long y)
+{
+    uint32_t *p = (uint32_t *) dst;
+    long i;
+
+    for (i = 0; i < n; i++)
+        p[i] = (uint32_t) src[i].blue << 24 | src[i].green << 16 |
+               src[i].red << 8;
+}
+
+/*
+ * 4 pixels fit in 3 words. Lines of a 24bpp fb are not necessarily word
+ * aligned, so let memcpy() decide how to do the store.
+ */
+static void _blit_row_rgb888(const struct ds_fb *fb, char *dst,
+                             const struct color *src, long n, long y)
+{
+    uint32_t w[3];
+    long i;
+
+    for (i = 0; i + 4 <= n; i += 4, src += 4, dst += sizeof(w)) {
+        w[0] = (uint32_t) src[0].blue | src[0].green << 8 |
+               src[0].red << 16 | (uint32_t) src[1].blue << 24;
+        w[1] = (uint32_t) src[1].green | src[1].red << 8 |
+               src[2].blue << 16 | (uint32_t) src[2].green << 24;
+        w[2] = (uint32_t) src[2].red | src[3].blue << 8 |
+               src[3].green << 16 | (uint32_t) src[3].red << 24;
+        memcpy(dst, w, sizeof(w));
+    }
+
+    for (; i < n; i++, src++) {
+        *dst++ = src->blue;
+        *dst++ = src->green;
+        *dst++ = src->red;
+    }
+}
+
+/*
+ * 16 and 8bpp: each channel goes through a lookup table that already holds
+ * the value shifted into place and quantized with a 4x4 ordered dither, so
+ * gradients don't band. There's one set of tables per position in the
+ * dither matrix.
+ */
+const unsigned char ds_blit_dither4x4[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+};
+
+static uint16_t _lut_dither[4][4][3][256];
+
+static void _lut_dither_init(const struct ds_fb *fb)
+{
+    const int length[3] = { fb->red_length, fb->green_length, fb->blue_length };
+    const int offset[3] = { fb->red_offset, fb->green_offset, fb->blue_offset };
+    int x, y, c, v;
+
+    for (y = 0; y < 4; y++)
+        for (x = 0; x < 4; x++)
+            for (c = 0; c < 3; c++) {
+                unsigned int maxval = (1 << length[c]) - 1;
+                unsigned int threshold = (2 * ds_blit_dither4x4[y][x] + 1) * 255;
+
+                for (v = 0; v < 256; v++) {
+                    unsigned int q = (v * maxval * 32 + threshold) / (255 * 32);
+                    _lut_dither[y][x][c][v] = q << offset[c];
+                }
+            }
+}
+
+#define PIXEL_DITHER(_lut, _src, _x)                                    \
+    ((_lut)[(_x) & 3][0][(_src)[_x].red] |                          \
+     (_lut)[(_x) & 3][1][(_src)[_x].green] |                        \
+     (_lut)[(_x) & 3][2][(_src)[_x].blue])
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define PAIR565(_first, _second) ((uint32_t) (_first) << 16 | (_second))
+#else
+#define PAIR565(_first, _second) ((_first) | (uint32_t) (_second) << 16)
+#endif
+
+static void _blit_row_565(const struct ds_fb *fb, char *dst,
+                          const struct color *src, long n, long y)
+{
+    const uint16_t (*lut)[3][256] = _lut_dither[y & 3];
+    uint32_t *p;
+    long i = 0;
+
+    if (n > 0 && ((uintptr_t) dst & 2)) {
+        *(uint16_t *) dst = PIXEL_DITHER(lut, src, 0);
+        dst += 2;
+        i++;
+    }
+
+    /* two pixels per store */
+    for (p = (uint32_t *) dst; i + 2 <= n; i += 2)
+        *p++ = PAIR565(PIXEL_DITHER(lut, src, i), PIXEL_DITHER(lut, src, i + 1));
+
+    if (i < n)
+        *(uint16_t *) p = PIXEL_DITHER(lut, src, i);
+}
+
+static void _blit_row_332(const struct ds_fb *fb, char *dst,
+                          const struct color *src, long n, long y)
+{
+    const uint16_t (*lut)[3][256] = _lut_dither[y & 3];
+    long i;
+
+    for (i = 0; i < n; i++)
+        dst[i] = PIXEL_DITHER(lut, src, i);
+}
+
+static unsigned char _blit_c8_closest(const struct ds_fb *fb,
+                                      const struct color *c)
+{
+    unsigned int i, best = 0, best_dist = UINT32_MAX;
+
+    for (i = 0; i < fb->palette_len && best_dist; i++) {
+        const struct color *p = &fb->palette[i];
+        int dr = p->red - c->red, dg = p->green - c->green;
+        int db = p->blue - c->blue;
+        unsigned int dist = dr * dr + dg * dg + db * db;
+
+        if (dist < best_dist) {
+            best = i;
+            best_dist = dist;
+        }
+    }
+
+    return best;
+}
+
+/*
+ * Pseudocolor with the palette of an image: each color becomes the closest
+ * entry. Only meant for the few colors drawn around that image, which is
+ * copied as is.
+ */
+static void _blit_row_c8(const struct ds_fb *fb, char *dst,
+                         const struct color *src, long n, long y)
+{
+    unsigned char index = 0;
+    long i;
+
+    for (i = 0; i < n; i++) {
+        if (!i || memcmp(&src[i], &src[i - 1], sizeof(*src)))
+            index = _blit_c8_closest(fb, &src[i]);
+        dst[i] = index;
+    }
+}
+
+/**
+ * Convert @n pixels from @src that start at column @x of row @y, dithered
+ * as they would be if the row was converted whole. The first ones, up to
+ * a column of the dither matrix, are converted after as many others.
+ */
+void ds_blit_row_at(const struct ds_fb *fb, char *dst, const struct color *src,
+                    long n, long x, long y)
+{
+    struct color head[4] = { { 0 } };
+    unsigned char out[4 * 4];
+    int bytes_per_pixel = fb->bits_per_pixel / 8;
+    long k = x & 3, m;
+
+    if (k && n) {
+        m = MIN(n, 4 - k);
+        memcpy(head + k, src, m * sizeof(*src));
+        fb->blit_row(fb, (char *) out, head, k + m, y);
+        memcpy(dst, out + k * bytes_per_pixel, m * bytes_per_pixel);
+
+        dst += m * bytes_per_pixel;
+        src += m;
+        n -= m;
+    }
+
+    if (n)
+        fb->blit_row(fb, dst, src, n, y);
+}
+
+/**
+ * Repeat @color, converted to the format of @fb, to fill @pattern. It will
+ * be used from column @x of row @y, which matters to formats that dither.
+ */
+void ds_blit_pattern(const struct ds_fb *fb, const struct color *color,
+                     long x, long y, unsigned char pattern[DS_BLIT_PATTERN_LEN])
+{
+    struct color row[DS_BLIT_PATTERN_LEN + 3];
+    unsigned char out[DS_BLIT_PATTERN_LEN + 3 * 4];
+    int i, bytes_per_pixel = fb->bits_per_pixel / 8;
+    int n = DS_BLIT_PATTERN_LEN / bytes_per_pixel + 3;
+
+    for (i = 0; i < n; i++)
+        row[i] = *color;
+
+    fb->blit_row(fb, (char *) out, row, n, y);
+    memcpy(pattern, out + (x & 3) * bytes_per_pixel, DS_BLIT_PATTERN_LEN);
+}
+
+/*
+ * Fill @len bytes with a pattern made by ds_blit_pattern(). Copies have a
+ * constant size so they become a few wide stores, whatever the pixel size.
+ */
+void ds_blit_fill_row(char *dst, const unsigned char *pattern, long len)
+{
+    for (; len >= DS_BLIT_PATTERN_LEN; len -= DS_BLIT_PATTERN_LEN) {
+        memcpy(dst, pattern, DS_BLIT_PATTERN_LEN);
+        dst += DS_BLIT_PATTERN_LEN;
+    }
+
+    memcpy(dst, pattern, len);
+}
+
+static inline unsigned char _blit_channel(uint32_t pixel, int offset,
+                                          int length)
+{
+    unsigned int c = (pixel >> offset) & ((1u << length) - 1);
+
+    /* widen by repeating the top bits, so full intensity stays 0xff */
+    c <<= 8 - length;
+
+    return c | c >> length;
+}
+
+/**
+ * Recover the colors of @n pixels at @src, laid out as described by @fb.
+ * Channels narrower than 8 bits don't get back what was lost when they
+ * were converted, so this is only meant as a fallback.
+ */
+void ds_blit_unpack_row(const struct ds_fb *fb, struct color *dst,
+                        const char *src, long n)
+{
+    int k, bytes_per_pixel = fb->bits_per_pixel / 8;
+    long i;
+
+    for (i = 0; i < n; i++, src += bytes_per_pixel) {
+        uint32_t pixel = 0;
+
+        if (bytes_per_pixel == 4) {
+            memcpy(&pixel, src, 4);
+        } else if (bytes_per_pixel == 2) {
+            uint16_t p16;
+
+            memcpy(&p16, src, 2);
+            pixel = p16;
+        } else {
+            for (k = 0; k < bytes_per_pixel; k++)
+                pixel |= (uint32_t) (unsigned char) src[k] << k * 8;
+        }
+
+        dst[i].red = _blit_channel(pixel, fb->red_offset, fb->red_length);
+        dst[i].green = _blit_channel(pixel, fb->green_offset,
+                                     fb->green_length);
+        dst[i].blue = _blit_channel(pixel, fb->blue_offset, fb->blue_length);
+    }
+}
+
+/**
+ * Convert the @n colors at @colors to the format of @fb, for drawing images
+ * indexing them with ds_blit_indexed_row(). Indices past @n are black, or
+ * anything on a pseudocolor fb already holding these colors.
+ */
+void ds_blit_palette_init(const struct ds_fb *fb, const struct color *colors,
+                          unsigned int n, struct ds_blit_palette *palette)
+{
+    struct color row[256 * 4];
+    unsigned int i, y;
+
+    n = MIN(n, 256u);
+    memset(row, 0, sizeof(row));
+    for (i = 0; i < 4 * n; i++)
+        row[i] = colors[i / 4];
+
+    palette->bytes_per_pixel = fb->bits_per_pixel / 8;
+    for (y = 0; y < 4; y++)
+        fb->blit_row(fb, (char *) palette->pixels[y], row, ARRAY_SIZE(row), y);
+
+    palette->identity = palette->bytes_per_pixel == 1;
+    for (i = 0; i < 4 * n && palette->identity; i++)
+        for (y = 0; y < 4; y++)
+            if (palette->pixels[y][i] != i / 4)
+                palette->identity = false;
+}
+
+/**
+ * Convert @n pixels at @src, indices into @palette, to @dst. @y is the
+ * index of the row, as for ds_blit_row_func.
+ */
+void ds_blit_indexed_row(const struct ds_blit_palette *palette, char *dst,
+                         const unsigned char *src, long n, long y)
+{
+    const unsigned char *table = palette->pixels[y & 3];
+    int bpp = palette->bytes_per_pixel;
+    long i;
+
+    if (palette->identity) {
+        memcpy(dst, src, n);
+        return;
+    }
+
+    switch (bpp) {
+    case 1:
+        for (i = 0; i < n; i++)
+            dst[i] = table[src[i] << 2 | (i & 3)];
+        break;
+    case 2:
+        for (i = 0; i < n; i++)
+            memcpy(dst + 2 * i, table + 2 * (src[i] << 2 | (i & 3)), 2);
+        break;
+    case 4:
+        for (i = 0; i < n; i++)
+            memcpy(dst + 4 * i, table + 4 * (src[i] << 2 | (i & 3)), 4);
+        break;
+    default:
+        for (i = 0; i < n; i++)
+            memcpy(dst + bpp * i, table + bpp * (src[i] << 2 | (i & 3)), bpp);
+        break;
+    }
+}
+
+/**
+ * Find out which of the known pixel layouts @fb uses
+ *
+ * @param fb framebuffer with bits_per_pixel and channel fields filled
+ *
+ * @return the layout or DS_FB_FORMAT_GENERIC if there's no specialized
+ * routine for it
+ */
+enum ds_fb_format ds_blit_format_detect(const struct ds_fb *fb)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(_formats); i++) {
+        if (_formats[i].bits_per_pixel == fb->bits_per_pixel &&
+            _formats[i].red_length == fb->red_length &&
+            _formats[i].red_offset == fb->red_offset &&
+            _formats[i].green_length == fb->green_length &&
+            _formats[i].green_offset == fb->green_offset &&
+            _formats[i].blue_length == fb->blue_length &&
+            _formats[i].blue_offset == fb->blue_offset)
+            return _formats[i].format;
+    }
+
+    return DS_FB_FORMAT_GENERIC;
+}
+
+/**
+ * Fill bits_per_pixel and channel fields of @fb to describe @format
+ *
+ * @return 0 on success or -1 if @format is DS_FB_FORMAT_GENERIC or C8, which
+ * are not described by channels
+ */
+int ds_blit_format_fill(struct ds_fb *fb, enum ds_fb_format format)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(_formats); i++) {
+        if (_formats[i].format != format)
+            continue;
+
+        fb->bits_per_pixel = _formats[i].bits_per_pixel;
+        fb->red_length = _formats[i].red_length;
+        fb->red_offset = _formats[i].red_offset;
+        fb->green_length = _formats[i].green_length;
+        fb->green_offset = _formats[i].green_offset;
+        fb->blue_length = _formats[i].blue_length;
+        fb->blue_offset = _formats[i].blue_offset;
+        fb->format = format;
+
+        return 0;
+    }
+
+    return -1;
+}
+
+enum ds_fb_format ds_blit_format_from_name(const char *name)
+{
+    unsigned int i;
+
+    if (!strcasecmp(name, "C8"))
+        return DS_FB_FORMAT_C8;
+
+    for (i = 0; i < ARRAY_SIZE(_formats); i++) {
+        if (!strcasecmp(_formats[i].name, name))
+            return _formats[i].format;
+    }
+
+    return DS_FB_FORMAT_GENERIC;
+}
+
+const char *ds_blit_format_name(enum ds_fb_format format)
+{
+    unsigned int i;
+
+    if (format == DS_FB_FORMAT_C8)
+        return "C8";
+
+    for (i = 0; i < ARRAY_SIZE(_formats); i++) {
+        if (_formats[i].format == format)
+            return _formats[i].name;
+    }
+
+    return "generic";
+}
+
+/**
+ * Same as ds_blit_row_func_get(), never picking a vectorized routine
+ */
+ds_blit_row_func ds_blit_scalar_row_func_get(const struct ds_fb *fb)
+{
+    switch (fb->format) {
+    case DS_FB_FORMAT_XRGB8888:
+        return _blit_row_xrgb8888;
+    case DS_FB_FORMAT_BGRX8888:
+        return _blit_row_bgrx8888;
+    case DS_FB_FORMAT_RGB888:
+        return _blit_row_rgb888;
+    case DS_FB_FORMAT_RGB565:
+    case DS_FB_FORMAT_BGR565:
+        _lut_dither_init(fb);
+        return _blit_row_565;
+    case DS_FB_FORMAT_RGB332:
+        _lut_dither_init(fb);
+        return _blit_row_332;
+    case DS_FB_FORMAT_C8:
+        return _blit_row_c8;
+    case DS_FB_FORMAT_GENERIC:
+        break;
+    }
+
+    return _blit_row_generic;
+}
+
+/**
+ * Choose the routine to convert rows to the format of @fb, preparing any
+ * table it needs
+ *
+ * @param fb framebuffer with channel fields and format filled
+ */
+ds_blit_row_func ds_blit_row_func_get(const struct ds_fb *fb)
+{
+    ds_blit_row_func func = ds_blit_simd_row_func_get(fb->format);
+
+    return func ? func : ds_blit_scalar_row_func_get(fb);
+}
@@ -0,0 +1,117 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * blit.h - conversion of image rows to framebuffer pixel formats
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#ifndef __DIETSPLASH_BLIT_H
+#define __DIETSPLASH_BLIT_H
+
+#include <stdbool.h>
+
+struct ds_fb;
+struct color;
+
+/*
+ * Pixel layouts we have specialized routines for. Names follow the order of
+ * channels from the most to the least significant bits of a pixel.
+ */
+enum ds_fb_format {
+    DS_FB_FORMAT_GENERIC = 0,
+    DS_FB_FORMAT_XRGB8888,
+    DS_FB_FORMAT_BGRX8888,
+    DS_FB_FORMAT_RGB888,
+    DS_FB_FORMAT_RGB565,
+    DS_FB_FORMAT_BGR565,
+    DS_FB_FORMAT_RGB332,
+    /* pseudocolor, with a palette that's not the RGB332 color cube */
+    DS_FB_FORMAT_C8,
+};
+
+/*
+ * Convert @n pixels from @src into @dst, laid out as expected by @fb. @y is
+ * the index of the row, used by formats that dither, which take @src as
+ * the start of the row.
+ */
+typedef void (*ds_blit_row_func)(const struct ds_fb *fb, char *dst,
+                                 const struct color *src, long n, long y);
+
+/*
+ * Long enough to hold a whole number of pixels of any format, and of
+ * columns of the dither matrix for the formats that dither
+ */
+#define DS_BLIT_PATTERN_LEN 24
+
+void ds_blit_row_at(const struct ds_fb *fb, char *dst, const struct color *src,
+                    long n, long x, long y);
+void ds_blit_pattern(const struct ds_fb *fb, const struct color *color,
+                     long x, long y, unsigned char pattern[DS_BLIT_PATTERN_LEN]);
+void ds_blit_fill_row(char *dst, const unsigned char *pattern, long len);
+void ds_blit_unpack_row(const struct ds_fb *fb, struct color *dst,
+                        const char *src, long n);
+
+/*
+ * Colors of a palette converted to the format of a fb. Formats that dither
+ * depend on where a pixel is, so each color is there for every column of
+ * the dither matrix: color c drawn at column x of row y is pixel
+ * c << 2 | (x & 3) of pixels[y & 3].
+ */
+struct ds_blit_palette {
+    /* first, blit_row may store whole pixels into it */
+    unsigned char pixels[4][256 * 4 * 4];
+    int bytes_per_pixel;
+    /* converting is copying: the fb is pseudocolor with this palette */
+    bool identity;
+};
+
+void ds_blit_palette_init(const struct ds_fb *fb, const struct color *colors,
+                          unsigned int n, struct ds_blit_palette *palette);
+void ds_blit_indexed_row(const struct ds_blit_palette *palette, char *dst,
+                         const unsigned char *src, long n, long y);
+
+enum ds_fb_format ds_blit_format_detect(const struct ds_fb *fb);
+int ds_blit_format_fill(struct ds_fb *fb, enum ds_fb_format format);
+enum ds_fb_format ds_blit_format_from_name(const char *name);
+const char *ds_blit_format_name(enum ds_fb_format format);
+ds_blit_row_func ds_blit_row_func_get(const struct ds_fb *fb);
+
+ds_blit_row_func ds_blit_scalar_row_func_get(const struct ds_fb *fb);
+
+/* thresholds of the ordered dither of 16 and 8bpp formats, 0 to 15 */
+extern const unsigned char ds_blit_dither4x4[4][4];
+
+/*
+ * Vectorized routine for @format, usable if @supported() says this CPU has
+ * the instructions it needs
+ */
+struct ds_blit_kernel {
+    const char *name;
+    enum ds_fb_format format;
+    ds_blit_row_func func;
+    bool (*supported)(void);
+};
+
+/* vectorized routine for @format supported by this CPU, if any */
+ds_blit_row_func ds_blit_simd_row_func_get(enum ds_fb_format format);
+const struct ds_blit_kernel *ds_blit_simd_kernels(unsigned int *n);
+
+#endif
@@ -0,0 +1,399 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * cache.c - background converted to the screen format, kept across boots
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+/*
+ * The result of reading, scaling and converting the background is the same
+ * on every boot as long as the image and the screen don't change. It's
+ * written to CACHE_DIR the first time it's computed and that location is
+ * writable, and on later boots it's read back with a single read().
+ *
+ * A built-in image is known by the hash computed when it was built. A file
+ * is known by its size, mtime and inode, and only hashed when one of them
+ * changed, or to write a new cache: if it's the same as before, the cache
+ * is used and then written again with the new ones.
+ *
+ * The header is written a field at a time, little endian and without
+ * padding, so it reads back the same whatever compiler or byte order wrote
+ * it, e.g. when the cache is prepared in a root filesystem image on the
+ * build host. The file hash doesn't depend on the byte order either.
+ */
+
+#include "log.h"
+#include "cache.h"
+#include "fb.h"
+#include "surface.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_FILE CACHE_DIR "/background.cache"
+#define CACHE_MAGIC "DSCACHE2"
+
+/*
+ * Bumped whenever the same background on the same screen is drawn
+ * differently, by a change to scaling, dithering or conversion
+ */
+#define CACHE_VERSION 1
+
+struct cache_header {
+    char magic[8];
+
+    /* key */
+    uint32_t version;
+    uint32_t bg_color;
+    uint32_t xres;
+    uint32_t yres;
+    uint32_t stride;
+    uint32_t bits_per_pixel;
+    uint32_t red_offset;
+    uint32_t red_length;
+    uint32_t green_offset;
+    uint32_t green_length;
+    uint32_t blue_offset;
+    uint32_t blue_length;
+    uint32_t scale;
+
+    /* the background file, all 0 if built in */
+    uint64_t size;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+
+    uint64_t hash;
+
+    /* surface stored after the header */
+    uint32_t width;
+    uint32_t height;
+    uint32_t surface_stride;
+};
+
+/* where the fields above are in the file, in the same order */
+#define KEY_SIZE (8 + 13 * 4)
+#define FILE_KEY_SIZE (4 * 8)
+#define HASH_OFFSET (KEY_SIZE + FILE_KEY_SIZE)
+#define SURFACE_OFFSET (HASH_OFFSET + 8)
+#define HEADER_SIZE (SURFACE_OFFSET + 3 * 4)
+
+static struct cache_header _key;
+static bool _pending;
+
+static unsigned char *_put_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+
+    return p + 4;
+}
+
+static unsigned char *_put_le64(unsigned char *p, uint64_t v)
+{
+    return _put_le32(_put_le32(p, v), v >> 32);
+}
+
+static inline uint32_t _le32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static inline uint64_t _le64(const unsigned char *p)
+{
+    return _le32(p) | (uint64_t) _le32(p + 4) << 32;
+}
+
+static void _cache_header_pack(const struct cache_header *h,
+                               unsigned char buf[HEADER_SIZE])
+{
+    unsigned char *p = buf;
+
+    memcpy(p, h->magic, sizeof(h->magic));
+    p += sizeof(h->magic);
+    p = _put_le32(p, h->version);
+    p = _put_le32(p, h->bg_color);
+    p = _put_le32(p, h->xres);
+    p = _put_le32(p, h->yres);
+    p = _put_le32(p, h->stride);
+    p = _put_le32(p, h->bits_per_pixel);
+    p = _put_le32(p, h->red_offset);
+    p = _put_le32(p, h->red_length);
+    p = _put_le32(p, h->green_offset);
+    p = _put_le32(p, h->green_length);
+    p = _put_le32(p, h->blue_offset);
+    p = _put_le32(p, h->blue_length);
+    p = _put_le32(p, h->scale);
+
+    p = _put_le64(p, h->size);
+    p = _put_le64(p, h->ino);
+    p = _put_le64(p, h->mtime_sec);
+    p = _put_le64(p, h->mtime_nsec);
+
+    p = _put_le64(p, h->hash);
+
+    p = _put_le32(p, h->width);
+    p = _put_le32(p, h->height);
+    _put_le32(p, h->surface_stride);
+}
+
+static int _cache_hash_file(int fd, size_t size, uint64_t *hash)
+{
+    void *map;
+
+    map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return -errno;
+
+    *hash = ds_hash(map, size);
+    munmap(map, size);
+
+    return 0;
+}
+
+static int _cache_read(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while (len) {
+        n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int _cache_write(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len) {
+        n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * Look for the background as scaled with @scale and converted for @fb. It's
+ * read from @filename or, if NULL, built in with @hash. On a miss the key
+ * is kept, so that ds_cache_save() can store the surface computed by the
+ * caller.
+ *
+ * @return the cached surface or NULL
+ */
+struct ds_surface *ds_cache_lookup(const struct ds_fb *fb, const char *filename,
+                                   uint64_t hash, unsigned int scale)
+{
+    unsigned char header[HEADER_SIZE], key[HEADER_SIZE];
+    unsigned int width, height, stride;
+    struct ds_surface *surface;
+    int fd, bg_fd = -1;
+    struct stat st;
+    bool hit;
+
+    memset(&_key, 0, sizeof(_key));
+    memcpy(_key.magic, CACHE_MAGIC, sizeof(_key.magic));
+    _key.version = CACHE_VERSION;
+    _key.bg_color = BACKGROUND_COLOR;
+    _key.xres = fb->xres;
+    _key.yres = fb->yres;
+    _key.stride = fb->stride;
+    _key.bits_per_pixel = fb->bits_per_pixel;
+    _key.red_offset = fb->red_offset;
+    _key.red_length = fb->red_length;
+    _key.green_offset = fb->green_offset;
+    _key.green_length = fb->green_length;
+    _key.blue_offset = fb->blue_offset;
+    _key.blue_length = fb->blue_length;
+    _key.scale = scale;
+    _key.hash = hash;
+    _pending = false;
+
+    if (filename) {
+        bg_fd = open(filename, O_RDONLY | O_CLOEXEC);
+        if (bg_fd < 0)
+            return NULL;
+
+        if (fstat(bg_fd, &st) < 0 || !st.st_size) {
+            close(bg_fd);
+            return NULL;
+        }
+
+        _key.size = st.st_size;
+        _key.ino = st.st_ino;
+        _key.mtime_sec = st.st_mtim.tv_sec;
+        _key.mtime_nsec = st.st_mtim.tv_nsec;
+    }
+
+    _cache_header_pack(&_key, key);
+
+    fd = open(CACHE_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || _cache_read(fd, header, sizeof(header)) < 0 ||
+        memcmp(header, key, KEY_SIZE)) {
+        hit = false;
+    } else if (!filename) {
+        hit = _le64(header + HASH_OFFSET) == _key.hash;
+    } else {
+        hit = !memcmp(header + KEY_SIZE, key + KEY_SIZE, FILE_KEY_SIZE);
+        /* touched or copied again, maybe not changed */
+        if (!hit) {
+            inf("background file changed, checking its contents");
+            hit = _cache_hash_file(bg_fd, st.st_size, &_key.hash) == 0 &&
+                  _le64(header + HASH_OFFSET) == _key.hash;
+            _pending = hit;
+        } else {
+            _key.hash = _le64(header + HASH_OFFSET);
+        }
+    }
+
+    if (!hit) {
+        /* the hash is needed to store what the caller is computing */
+        if (filename && !_key.hash &&
+            _cache_hash_file(bg_fd, st.st_size, &_key.hash) < 0) {
+            close(bg_fd);
+            if (fd >= 0)
+                close(fd);
+            return NULL;
+        }
+
+        if (fd >= 0) {
+            inf("background cache is stale");
+            close(fd);
+        }
+        if (bg_fd >= 0)
+            close(bg_fd);
+        _pending = true;
+        return NULL;
+    }
+
+    if (bg_fd >= 0)
+        close(bg_fd);
+
+    width = _le32(header + SURFACE_OFFSET);
+    height = _le32(header + SURFACE_OFFSET + 4);
+    stride = _le32(header + SURFACE_OFFSET + 8);
+
+    surface = ds_surface_new(fb, width, height);
+    if (!surface) {
+        close(fd);
+        return NULL;
+    }
+
+    if (surface->stride != stride ||
+        _cache_read(fd, surface->data,
+                    surface->stride * surface->height) < 0) {
+        wrn("background cache is truncated");
+        ds_surface_free(surface);
+        close(fd);
+        _pending = true;
+        return NULL;
+    }
+
+    close(fd);
+    inf("background read from cache");
+
+    return surface;
+}
+
+/**
+ * Store @surface under the key of the last lookup, if it missed. Meant to
+ * be called again later if CACHE_DIR was not writable yet, e.g. while the
+ * root filesystem is still read-only.
+ *
+ * @return 0 if the cache is up to date, or a negative errno
+ */
+int ds_cache_save(const struct ds_surface *surface)
+{
+    struct cache_header key = _key;
+    unsigned char header[HEADER_SIZE];
+    int fd;
+
+    if (!_pending)
+        return 0;
+
+    if (mkdir(CACHE_DIR, 0755) < 0 && errno != EEXIST)
+        return -errno;
+
+    fd = open(CACHE_FILE ".tmp", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+              0644);
+    if (fd < 0)
+        return -errno;
+
+    key.width = surface->width;
+    key.height = surface->height;
+    key.surface_stride = surface->stride;
+    _cache_header_pack(&key, header);
+
+    if (_cache_write(fd, header, sizeof(header)) < 0 ||
+        _cache_write(fd, surface->data,
+                     surface->stride * surface->height) < 0 ||
+        fsync(fd) < 0) {
+        int ret = -errno;
+
+        err("writing background cache -- %m");
+        close(fd);
+        unlink(CACHE_FILE ".tmp");
+        return ret;
+    }
+
+    close(fd);
+
+    /* readers only ever see a complete file */
+    if (rename(CACHE_FILE ".tmp", CACHE_FILE) < 0) {
+        int ret = -errno;
+
+        err("renaming background cache -- %m");
+        unlink(CACHE_FILE ".tmp");
+        return ret;
+    }
+
+    _pending = false;
+    inf("background cache written");
+
+    return 0;
+}
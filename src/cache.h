@@ -0,0 +1,38 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * cache.h - background converted to the screen format, kept across boots
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#ifndef __DIETSPLASH_CACHE_H
+#define __DIETSPLASH_CACHE_H
+
+#include <stdint.h>
+
+struct ds_fb;
+struct ds_surface;
+
+struct ds_surface *ds_cache_lookup(const struct ds_fb *fb, const char *filename,
+                                   uint64_t hash, unsigned int scale);
+int ds_cache_save(const struct ds_surface *surface);
+
+#endif
@@ -1,5 +1,8 @@
 #include "log.h"
+#include "animation.h"
 #include "events.h"
+#include "progress.h"
+#include "status.h"
 #include <assert.h>
 #include <errno.h>
 #include <stdbool.h>
@@ -24,14 +27,23 @@ static int epollfd = -1;
 
 /* callbacks */
 static void on_quit(int fd);
+#ifdef ENABLE_ANIMATION
+static void on_animation(int fd);
+#endif
 static void on_connection_request(int fd);
 static void on_command(int fd);
 
 static struct cb _timers[TIMERS_NR] = {
-    {
+    [TIMERS_QUIT] = {
        .fd = -1,
        .func = on_quit
-    }
+    },
+    [TIMERS_ANIMATION] = {
+       .fd = -1,
+#ifdef ENABLE_ANIMATION
+       .func = on_animation
+#endif
+    },
 };
 
 static struct cmds {
@@ -48,6 +60,11 @@ static struct cmds {
 
 #define MAX_EPOLL_EVENTS 5
 #define MAX_CMDS_EVENTS 5
+#define MAX_WATCHES 2
+
+/* fds owned by other modules, they are responsible for closing them */
+static struct cb _watches[MAX_WATCHES];
+static int _n_watches;
 #define CMDS_SOCKET_NAME "/dietsplash"
 
 int ds_events_shutdown(void)
@@ -94,9 +111,9 @@ static void on_command(int fd) {
     char buf[MAX_CMD_LEN + 1];
     int n;
 
-    buf[MAX_CMD_LEN] = '\0';
-
-    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    /* the last byte is kept for the terminator */
+    while ((n = read(fd, buf, sizeof(buf) - 1)) > 0) {
+        buf[n] = '\0';
         _cmds.boot_status.perc = (unsigned char) buf[0];
 
         if (n < 2 || (unsigned int)(n - 2) != strlen(&buf[1]))
@@ -104,15 +121,25 @@ static void on_command(int fd) {
 
         inf("Command received: perc: %u%% message: %s",
                                                 _cmds.boot_status.perc, &buf[1]);
+
+        /* save the latest boot status */
+        memcpy(&_cmds.boot_status.msg, &(buf[1]), MAX_CMD_LEN);
     }
 
-    /* save the latest boot status */
-    memcpy(&_cmds.boot_status.msg, &(buf[1]), MAX_CMD_LEN);
+#ifdef ENABLE_PROGRESS
+    /* a burst of commands read at once is drawn once */
+    ds_progress_set(_cmds.boot_status.perc);
+#endif
+
+#ifdef ENABLE_STATUS
+    ds_status_set(_cmds.boot_status.msg);
+#endif
 
     if (_cmds.boot_status.perc == 100)
         ds_events_stop(MAINLOOP_STATUS_EXIT_SUCCESS);
 
-    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    /* EWOULDBLOCK is the same on Linux */
+    if (n < 0 && errno == EAGAIN)
         return;
 
     /* Client closed the connection */
@@ -123,16 +150,33 @@ static void on_command(int fd) {
 static void on_quit(int fd)
 {
     uint64_t buf;
+    ssize_t ret;
 
-    while (read(fd, &buf, sizeof(buf)) > 0)
+    while ((ret = read(fd, &buf, sizeof(buf))) > 0)
         ;
 
-    if (errno != EAGAIN && errno != EWOULDBLOCK)
+    if (ret < 0 && errno != EAGAIN)
         err("read quit timer");
 
     ds_events_stop(MAINLOOP_STATUS_EXIT_FAILURE);
 }
 
+#ifdef ENABLE_ANIMATION
+static void on_animation(int fd)
+{
+    uint64_t ticks, total = 0;
+    ssize_t ret;
+
+    while ((ret = read(fd, &ticks, sizeof(ticks))) > 0)
+        total += ticks;
+
+    if (ret < 0 && errno != EAGAIN)
+        err("read animation timer");
+
+    ds_animation_tick(total);
+}
+#endif
+
 static void on_connection_request(int fd)
 {
     int s;
@@ -224,6 +268,34 @@ static void _process_events(struct epoll_event *ev)
     cb->func(cb->fd);
 }
 
+/**
+ * Call @func whenever @fd becomes readable
+ *
+ * @return @fd or -1 on error
+ */
+int ds_events_watch(int fd, void (*func)(int fd))
+{
+    struct epoll_event ev;
+    struct cb *cb;
+
+    assert(_n_watches < MAX_WATCHES);
+
+    cb = &_watches[_n_watches];
+    cb->fd = fd;
+    cb->func = func;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = cb;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        err("epoll_ctl: fd - %m");
+        return -1;
+    }
+
+    _n_watches++;
+
+    return fd;
+}
+
 int ds_events_timer_add(int idx, time_t tv_sec, long tv_nsec, bool oneshot)
 {
     struct itimerspec tm = { { 0 }, { 0 } };
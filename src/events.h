@@ -33,6 +33,7 @@
 
 enum timers {
     TIMERS_QUIT = 0,
+    TIMERS_ANIMATION,
     TIMERS_NR
 };
 
@@ -50,5 +51,6 @@ int ds_events_run(void);
 void ds_events_stop(enum mainloop_status status);
 
 int ds_events_timer_add(int idx, time_t tv_sec, long tv_nsec, bool oneshot);
+int ds_events_watch(int fd, void (*func)(int fd));
 
 #endif
@@ -0,0 +1,824 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * fb-drm.c - DRM/KMS backend using dumb buffers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+/*
+ * Only the kernel uapi headers are used, there's no dependency on libdrm.
+ * The first connected connector is driven with its preferred mode, through
+ * two dumb buffers: the first frame is a modeset and the following ones are
+ * page flips, completed when the main loop reads the flip event. Both are
+ * atomic commits on the primary plane of the CRTC; drivers without atomic
+ * modesetting get the legacy SETCRTC and PAGE_FLIP instead. Without a GPU,
+ * this can be tried with the vkms driver.
+ */
+
+#include "log.h"
+#include "fb.h"
+#include "util.h"
+
+#ifdef HAVE_DRM_DRM_MODE_H
+#include <drm/drm.h>
+#include <drm/drm_mode.h>
+#else
+#include <libdrm/drm.h>
+#include <libdrm/drm_mode.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define DRM_PATH "/dev/dri/card0"
+
+/* from enum drm_plane_type, which is not part of the uapi headers */
+#ifndef DRM_PLANE_TYPE_PRIMARY
+#define DRM_PLANE_TYPE_PRIMARY 1
+#endif
+
+enum drm_plane_prop {
+    PLANE_FB_ID,
+    PLANE_CRTC_ID,
+    PLANE_SRC_X,
+    PLANE_SRC_Y,
+    PLANE_SRC_W,
+    PLANE_SRC_H,
+    PLANE_CRTC_X,
+    PLANE_CRTC_Y,
+    PLANE_CRTC_W,
+    PLANE_CRTC_H,
+    PLANE_PROPS
+};
+
+static const char *const _drm_plane_props[PLANE_PROPS] = {
+    [PLANE_FB_ID] = "FB_ID",
+    [PLANE_CRTC_ID] = "CRTC_ID",
+    [PLANE_SRC_X] = "SRC_X",
+    [PLANE_SRC_Y] = "SRC_Y",
+    [PLANE_SRC_W] = "SRC_W",
+    [PLANE_SRC_H] = "SRC_H",
+    [PLANE_CRTC_X] = "CRTC_X",
+    [PLANE_CRTC_Y] = "CRTC_Y",
+    [PLANE_CRTC_W] = "CRTC_W",
+    [PLANE_CRTC_H] = "CRTC_H",
+};
+
+enum drm_crtc_prop {
+    CRTC_MODE_ID,
+    CRTC_ACTIVE,
+    CRTC_PROPS
+};
+
+static const char *const _drm_crtc_props[CRTC_PROPS] = {
+    [CRTC_MODE_ID] = "MODE_ID",
+    [CRTC_ACTIVE] = "ACTIVE",
+};
+
+static const char *const _drm_conn_props[] = { "CRTC_ID" };
+
+/* at most one modeset: connector, CRTC and plane */
+struct drm_atomic_req {
+    uint32_t objs[3];
+    uint32_t count_props[3];
+    uint32_t props[1 + CRTC_PROPS + PLANE_PROPS];
+    uint64_t values[1 + CRTC_PROPS + PLANE_PROPS];
+    unsigned int n_objs;
+    unsigned int n_props;
+};
+
+struct drm_buf {
+    uint32_t handle;
+    uint32_t fb_id;
+    uint64_t size;
+    char *map;
+};
+
+static struct {
+    struct ds_fb *fb;
+    uint32_t conn_id;
+    uint32_t crtc_id;
+    unsigned int crtc_index;
+    struct drm_mode_modeinfo mode;
+    struct drm_mode_crtc saved_crtc;
+    bool modeset;
+    struct drm_buf bufs[2];
+    /* atomic modesetting, set up by query if the driver has it */
+    bool atomic;
+    uint32_t plane_id;
+    uint32_t mode_blob;
+    uint32_t conn_prop_crtc_id;
+    uint32_t crtc_props[CRTC_PROPS];
+    uint32_t plane_props[PLANE_PROPS];
+} _drm;
+
+static int _drm_ioctl(int fd, unsigned long request, void *arg)
+{
+    int ret;
+
+    do {
+        ret = ioctl(fd, request, arg);
+    } while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+
+    return ret;
+}
+
+static int _drm_open(struct ds_fb *fb)
+{
+    struct drm_get_cap cap = { .capability = DRM_CAP_DUMB_BUFFER };
+    struct drm_set_client_cap atomic = {
+        .capability = DRM_CLIENT_CAP_ATOMIC,
+        .value = 1,
+    };
+
+    if (ds_fs_setup(DRM_PATH) < 0)
+        return -ENODEV;
+
+    fb->fd = open(DRM_PATH, O_RDWR | O_CLOEXEC | O_NONBLOCK);
+    if (fb->fd < 0) {
+        int ret = -errno;
+
+        inf("open failed -- %m");
+        ds_fs_shutdown();
+        return ret;
+    }
+
+    if (_drm_ioctl(fb->fd, DRM_IOCTL_GET_CAP, &cap) == -1 || !cap.value) {
+        inf("drm device has no dumb buffers");
+        close(fb->fd);
+        ds_fs_shutdown();
+        return -ENODEV;
+    }
+
+    /* implies universal planes, so the primary plane can be found */
+    _drm.atomic = _drm_ioctl(fb->fd, DRM_IOCTL_SET_CLIENT_CAP, &atomic) == 0;
+
+    _drm.fb = fb;
+
+    return 0;
+}
+
+/*
+ * Find a CRTC able to drive @conn: the one already attached to it if any,
+ * otherwise the first one allowed by its encoders
+ */
+static uint32_t _drm_find_crtc(int fd, const struct drm_mode_card_res *res,
+                               const struct drm_mode_get_connector *conn)
+{
+    const uint32_t *encoders = (const uint32_t *)(uintptr_t) conn->encoders_ptr;
+    const uint32_t *crtcs = (const uint32_t *)(uintptr_t) res->crtc_id_ptr;
+    struct drm_mode_get_encoder enc;
+    unsigned int i, j;
+
+    if (conn->encoder_id) {
+        memset(&enc, 0, sizeof(enc));
+        enc.encoder_id = conn->encoder_id;
+        if (_drm_ioctl(fd, DRM_IOCTL_MODE_GETENCODER, &enc) == 0 &&
+            enc.crtc_id)
+            return enc.crtc_id;
+    }
+
+    for (i = 0; i < conn->count_encoders; i++) {
+        memset(&enc, 0, sizeof(enc));
+        enc.encoder_id = encoders[i];
+        if (_drm_ioctl(fd, DRM_IOCTL_MODE_GETENCODER, &enc) == -1)
+            continue;
+
+        for (j = 0; j < res->count_crtcs; j++) {
+            if (enc.possible_crtcs & (1 << j))
+                return crtcs[j];
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Fill @conn with the connector's modes and encoders, which are returned in
+ * arrays that must be freed by the caller
+ */
+static int _drm_get_connector(int fd, uint32_t id,
+                              struct drm_mode_get_connector *conn)
+{
+    struct drm_mode_modeinfo *modes;
+    uint32_t *encoders;
+
+    memset(conn, 0, sizeof(*conn));
+    conn->connector_id = id;
+    if (_drm_ioctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, conn) == -1)
+        return -1;
+
+    modes = calloc(conn->count_modes + 1, sizeof(*modes));
+    encoders = calloc(conn->count_encoders + 1, sizeof(*encoders));
+    if (!modes || !encoders)
+        goto free_on_err;
+
+    conn->modes_ptr = (uintptr_t) modes;
+    conn->encoders_ptr = (uintptr_t) encoders;
+    conn->count_props = 0;
+    conn->props_ptr = 0;
+    conn->prop_values_ptr = 0;
+
+    if (_drm_ioctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, conn) == -1)
+        goto free_on_err;
+
+    return 0;
+
+free_on_err:
+    free(modes);
+    free(encoders);
+    conn->modes_ptr = conn->encoders_ptr = 0;
+    return -1;
+}
+
+static int _drm_find_output(int fd)
+{
+    struct drm_mode_card_res res;
+    uint32_t *crtcs = NULL, *conns = NULL, *encs = NULL;
+    unsigned int i, j;
+    int ret = -ENODEV;
+
+    memset(&res, 0, sizeof(res));
+    if (_drm_ioctl(fd, DRM_IOCTL_MODE_GETRESOURCES, &res) == -1) {
+        ret = -errno;
+        err("getting drm resources -- %m");
+        return ret;
+    }
+
+    crtcs = calloc(res.count_crtcs + 1, sizeof(*crtcs));
+    conns = calloc(res.count_connectors + 1, sizeof(*conns));
+    encs = calloc(res.count_encoders + 1, sizeof(*encs));
+    if (!crtcs || !conns || !encs) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    res.count_fbs = 0;
+    res.fb_id_ptr = 0;
+    res.crtc_id_ptr = (uintptr_t) crtcs;
+    res.connector_id_ptr = (uintptr_t) conns;
+    res.encoder_id_ptr = (uintptr_t) encs;
+    if (_drm_ioctl(fd, DRM_IOCTL_MODE_GETRESOURCES, &res) == -1) {
+        ret = -errno;
+        err("getting drm resources -- %m");
+        goto out;
+    }
+
+    for (i = 0; i < res.count_connectors && ret; i++) {
+        struct drm_mode_get_connector conn;
+        struct drm_mode_modeinfo *modes;
+
+        if (_drm_get_connector(fd, conns[i], &conn) < 0)
+            continue;
+
+        modes = (struct drm_mode_modeinfo *)(uintptr_t) conn.modes_ptr;
+
+        if (conn.connection == 1 && conn.count_modes > 0) {
+            _drm.crtc_id = _drm_find_crtc(fd, &res, &conn);
+            if (_drm.crtc_id) {
+                _drm.conn_id = conn.connector_id;
+                _drm.mode = modes[0];
+                for (j = 0; j < conn.count_modes; j++) {
+                    if (modes[j].type & DRM_MODE_TYPE_PREFERRED) {
+                        _drm.mode = modes[j];
+                        break;
+                    }
+                }
+                for (j = 0; j < res.count_crtcs; j++) {
+                    if (crtcs[j] == _drm.crtc_id)
+                        _drm.crtc_index = j;
+                }
+                ret = 0;
+            }
+        }
+
+        free(modes);
+        free((void *)(uintptr_t) conn.encoders_ptr);
+    }
+
+    if (ret)
+        err("no connected output found");
+
+out:
+    free(crtcs);
+    free(conns);
+    free(encs);
+    return ret;
+}
+
+/*
+ * Look up the properties of an object named in @names, storing their ids in
+ * @ids in the same order and, if @values is given, their current values.
+ * Returns 0 if all of them were found.
+ */
+static int _drm_get_props(int fd, uint32_t obj_id, uint32_t obj_type,
+                          const char *const *names, unsigned int n,
+                          uint32_t *ids, uint64_t *values)
+{
+    struct drm_mode_obj_get_properties props;
+    uint32_t *prop_ids = NULL;
+    uint64_t *prop_values = NULL;
+    unsigned int i, j, found = 0;
+
+    memset(&props, 0, sizeof(props));
+    props.obj_id = obj_id;
+    props.obj_type = obj_type;
+    if (_drm_ioctl(fd, DRM_IOCTL_MODE_OBJ_GETPROPERTIES, &props) == -1)
+        return -1;
+
+    prop_ids = calloc(props.count_props + 1, sizeof(*prop_ids));
+    prop_values = calloc(props.count_props + 1, sizeof(*prop_values));
+    if (!prop_ids || !prop_values)
+        goto out;
+
+    props.props_ptr = (uintptr_t) prop_ids;
+    props.prop_values_ptr = (uintptr_t) prop_values;
+    if (_drm_ioctl(fd, DRM_IOCTL_MODE_OBJ_GETPROPERTIES, &props) == -1)
+        goto out;
+
+    memset(ids, 0, n * sizeof(*ids));
+    for (i = 0; i < props.count_props; i++) {
+        struct drm_mode_get_property prop;
+
+        memset(&prop, 0, sizeof(prop));
+        prop.prop_id = prop_ids[i];
+        if (_drm_ioctl(fd, DRM_IOCTL_MODE_GETPROPERTY, &prop) == -1)
+            continue;
+
+        for (j = 0; j < n; j++) {
+            if (ids[j] || strncmp(prop.name, names[j], sizeof(prop.name)))
+                continue;
+
+            ids[j] = prop_ids[i];
+            if (values)
+                values[j] = prop_values[i];
+            found++;
+        }
+    }
+
+out:
+    free(prop_ids);
+    free(prop_values);
+    return found == n ? 0 : -1;
+}
+
+/*
+ * Find the primary plane of the CRTC at @crtc_index
+ */
+static uint32_t _drm_find_plane(int fd, unsigned int crtc_index)
+{
+    static const char *const type_prop[] = { "type" };
+    struct drm_mode_get_plane_res res;
+    uint32_t *planes, plane_id = 0;
+    unsigned int i;
+
+    memset(&res, 0, sizeof(res));
+    if (_drm_ioctl(fd, DRM_IOCTL_MODE_GETPLANERESOURCES, &res) == -1)
+        return 0;
+
+    planes = calloc(res.count_planes + 1, sizeof(*planes));
+    if (!planes)
+        return 0;
+
+    res.plane_id_ptr = (uintptr_t) planes;
+    if (_drm_ioctl(fd, DRM_IOCTL_MODE_GETPLANERESOURCES, &res) == -1)
+        goto out;
+
+    for (i = 0; i < res.count_planes && !plane_id; i++) {
+        struct drm_mode_get_plane plane;
+        uint32_t type_id;
+        uint64_t type;
+
+        memset(&plane, 0, sizeof(plane));
+        plane.plane_id = planes[i];
+        if (_drm_ioctl(fd, DRM_IOCTL_MODE_GETPLANE, &plane) == -1 ||
+            !(plane.possible_crtcs & (1 << crtc_index)))
+            continue;
+
+        if (_drm_get_props(fd, planes[i], DRM_MODE_OBJECT_PLANE, type_prop,
+                           1, &type_id, &type) == 0 &&
+            type == DRM_PLANE_TYPE_PRIMARY)
+            plane_id = planes[i];
+    }
+
+out:
+    free(planes);
+    return plane_id;
+}
+
+/*
+ * Get everything the atomic commits refer to: the primary plane, the ids
+ * of the properties set and a blob holding the mode
+ */
+static int _drm_atomic_setup(int fd)
+{
+    struct drm_mode_create_blob blob;
+
+    _drm.plane_id = _drm_find_plane(fd, _drm.crtc_index);
+    if (!_drm.plane_id)
+        return -1;
+
+    if (_drm_get_props(fd, _drm.conn_id, DRM_MODE_OBJECT_CONNECTOR,
+                       _drm_conn_props, 1, &_drm.conn_prop_crtc_id,
+                       NULL) < 0 ||
+        _drm_get_props(fd, _drm.crtc_id, DRM_MODE_OBJECT_CRTC,
+                       _drm_crtc_props, CRTC_PROPS, _drm.crtc_props,
+                       NULL) < 0 ||
+        _drm_get_props(fd, _drm.plane_id, DRM_MODE_OBJECT_PLANE,
+                       _drm_plane_props, PLANE_PROPS, _drm.plane_props,
+                       NULL) < 0)
+        return -1;
+
+    memset(&blob, 0, sizeof(blob));
+    blob.data = (uintptr_t) &_drm.mode;
+    blob.length = sizeof(_drm.mode);
+    if (_drm_ioctl(fd, DRM_IOCTL_MODE_CREATEPROPBLOB, &blob) == -1)
+        return -1;
+
+    _drm.mode_blob = blob.blob_id;
+
+    return 0;
+}
+
+static void _drm_atomic_add(struct drm_atomic_req *req, uint32_t obj,
+                            uint32_t prop, uint64_t value)
+{
+    if (!req->n_objs || req->objs[req->n_objs - 1] != obj) {
+        req->objs[req->n_objs] = obj;
+        req->count_props[req->n_objs++] = 0;
+    }
+
+    req->count_props[req->n_objs - 1]++;
+    req->props[req->n_props] = prop;
+    req->values[req->n_props++] = value;
+}
+
+static int _drm_atomic_commit(int fd, const struct drm_atomic_req *req,
+                              uint32_t flags)
+{
+    struct drm_mode_atomic atomic;
+
+    memset(&atomic, 0, sizeof(atomic));
+    atomic.flags = flags;
+    atomic.count_objs = req->n_objs;
+    atomic.objs_ptr = (uintptr_t) req->objs;
+    atomic.count_props_ptr = (uintptr_t) req->count_props;
+    atomic.props_ptr = (uintptr_t) req->props;
+    atomic.prop_values_ptr = (uintptr_t) req->values;
+
+    return _drm_ioctl(fd, DRM_IOCTL_MODE_ATOMIC, &atomic);
+}
+
+/*
+ * Put the fb of @buf on screen. A modeset lights up the connector with our
+ * mode and is waited for, a flip returns at once and completes with an
+ * event.
+ */
+static int _drm_atomic_show(int fd, const struct drm_buf *buf, bool modeset)
+{
+    struct drm_atomic_req req;
+    const uint32_t *pp = _drm.plane_props;
+    uint32_t plane = _drm.plane_id;
+
+    memset(&req, 0, sizeof(req));
+
+    if (!modeset) {
+        _drm_atomic_add(&req, plane, pp[PLANE_FB_ID], buf->fb_id);
+        return _drm_atomic_commit(fd, &req, DRM_MODE_ATOMIC_NONBLOCK |
+                                  DRM_MODE_PAGE_FLIP_EVENT);
+    }
+
+    _drm_atomic_add(&req, _drm.conn_id, _drm.conn_prop_crtc_id,
+                    _drm.crtc_id);
+    _drm_atomic_add(&req, _drm.crtc_id, _drm.crtc_props[CRTC_MODE_ID],
+                    _drm.mode_blob);
+    _drm_atomic_add(&req, _drm.crtc_id, _drm.crtc_props[CRTC_ACTIVE], 1);
+    _drm_atomic_add(&req, plane, pp[PLANE_FB_ID], buf->fb_id);
+    _drm_atomic_add(&req, plane, pp[PLANE_CRTC_ID], _drm.crtc_id);
+    /* source is in 16.16 fixed point */
+    _drm_atomic_add(&req, plane, pp[PLANE_SRC_X], 0);
+    _drm_atomic_add(&req, plane, pp[PLANE_SRC_Y], 0);
+    _drm_atomic_add(&req, plane, pp[PLANE_SRC_W],
+                    (uint64_t) _drm.mode.hdisplay << 16);
+    _drm_atomic_add(&req, plane, pp[PLANE_SRC_H],
+                    (uint64_t) _drm.mode.vdisplay << 16);
+    _drm_atomic_add(&req, plane, pp[PLANE_CRTC_X], 0);
+    _drm_atomic_add(&req, plane, pp[PLANE_CRTC_Y], 0);
+    _drm_atomic_add(&req, plane, pp[PLANE_CRTC_W], _drm.mode.hdisplay);
+    _drm_atomic_add(&req, plane, pp[PLANE_CRTC_H], _drm.mode.vdisplay);
+
+    return _drm_atomic_commit(fd, &req, DRM_MODE_ATOMIC_ALLOW_MODESET);
+}
+
+static int _drm_buf_create(int fd, struct drm_buf *buf, struct ds_fb *fb)
+{
+    struct drm_mode_create_dumb create;
+    struct drm_mode_fb_cmd cmd;
+    struct drm_mode_destroy_dumb destroy;
+
+    memset(&create, 0, sizeof(create));
+    create.width = fb->xres;
+    create.height = fb->yres;
+    create.bpp = fb->bits_per_pixel;
+    if (_drm_ioctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) == -1) {
+        int ret = -errno;
+
+        err("creating dumb buffer -- %m");
+        return ret;
+    }
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.width = fb->xres;
+    cmd.height = fb->yres;
+    cmd.pitch = create.pitch;
+    cmd.bpp = fb->bits_per_pixel;
+    cmd.depth = 24;
+    cmd.handle = create.handle;
+    if (_drm_ioctl(fd, DRM_IOCTL_MODE_ADDFB, &cmd) == -1) {
+        int ret = -errno;
+
+        err("adding drm framebuffer -- %m");
+        destroy.handle = create.handle;
+        _drm_ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+        return ret;
+    }
+
+    buf->handle = create.handle;
+    buf->fb_id = cmd.fb_id;
+    buf->size = create.size;
+    buf->map = NULL;
+    fb->stride = create.pitch;
+
+    return 0;
+}
+
+static void _drm_buf_destroy(int fd, struct drm_buf *buf)
+{
+    struct drm_mode_destroy_dumb destroy = { .handle = buf->handle };
+
+    if (!buf->handle)
+        return;
+
+    if (buf->map && munmap(buf->map, buf->size) == -1)
+        err("drm munmap -- %m");
+
+    _drm_ioctl(fd, DRM_IOCTL_MODE_RMFB, &buf->fb_id);
+    _drm_ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+    memset(buf, 0, sizeof(*buf));
+}
+
+static void _drm_blob_destroy(int fd)
+{
+    struct drm_mode_destroy_blob destroy = { .blob_id = _drm.mode_blob };
+
+    if (!_drm.mode_blob)
+        return;
+
+    _drm_ioctl(fd, DRM_IOCTL_MODE_DESTROYPROPBLOB, &destroy);
+    _drm.mode_blob = 0;
+}
+
+static int _drm_query(struct ds_fb *fb)
+{
+    int ret, i;
+
+    ret = _drm_find_output(fb->fd);
+    if (ret)
+        return ret;
+
+    /* restored on close, so whatever was shown before comes back */
+    memset(&_drm.saved_crtc, 0, sizeof(_drm.saved_crtc));
+    _drm.saved_crtc.crtc_id = _drm.crtc_id;
+    if (_drm_ioctl(fb->fd, DRM_IOCTL_MODE_GETCRTC, &_drm.saved_crtc) == -1)
+        _drm.saved_crtc.crtc_id = 0;
+
+    _drm.mode_blob = 0;
+    if (_drm.atomic && _drm_atomic_setup(fb->fd) < 0) {
+        inf("drm atomic setup failed, using legacy modeset");
+        _drm.atomic = false;
+    }
+
+    ds_blit_format_fill(fb, DS_FB_FORMAT_XRGB8888);
+    fb->xres = fb->xres_virtual = _drm.mode.hdisplay;
+    fb->yres = fb->yres_virtual = _drm.mode.vdisplay;
+    fb->xoffset = fb->yoffset = 0;
+
+    for (i = 0; i < 2; i++) {
+        ret = _drm_buf_create(fb->fd, &_drm.bufs[i], fb);
+        if (ret)
+            goto destroy_on_err;
+    }
+
+    inf("DRM connector %u, crtc %u, mode %s%s", _drm.conn_id, _drm.crtc_id,
+        _drm.mode.name, _drm.atomic ? ", atomic" : "");
+
+    return 0;
+
+destroy_on_err:
+    while (i--)
+        _drm_buf_destroy(fb->fd, &_drm.bufs[i]);
+    _drm_blob_destroy(fb->fd);
+    return ret;
+}
+
+static int _drm_map(struct ds_fb *fb)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        struct drm_mode_map_dumb map = { .handle = _drm.bufs[i].handle };
+        void *p;
+
+        if (_drm_ioctl(fb->fd, DRM_IOCTL_MODE_MAP_DUMB, &map) == -1) {
+            int ret = -errno;
+
+            crit("mapping dumb buffer -- %m");
+            return ret;
+        }
+
+        p = mmap(0, _drm.bufs[i].size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fb->fd, map.offset);
+        if (p == MAP_FAILED) {
+            int ret = -errno;
+
+            crit("drm mmapping -- %m");
+            return ret;
+        }
+
+        _drm.bufs[i].map = p;
+        fb->page[i] = p;
+    }
+
+    /* without a shadow buffer we draw straight into what is scanned out */
+    fb->pages = fb->shadow ? 2 : 1;
+    fb->front = 0;
+    fb->data = fb->page[0];
+    fb->screen_size = fb->stride * fb->yres;
+    _drm.modeset = false;
+
+    return 0;
+}
+
+static int _drm_flush(struct ds_fb *fb, int page)
+{
+    struct drm_mode_crtc_page_flip flip;
+
+    if (!_drm.modeset && _drm.atomic) {
+        if (_drm_atomic_show(fb->fd, &_drm.bufs[page], true) == 0) {
+            _drm.modeset = true;
+            return 0;
+        }
+
+        inf("drm atomic modeset failed, using legacy modeset -- %m");
+        _drm.atomic = false;
+    }
+
+    if (!_drm.modeset) {
+        struct drm_mode_crtc crtc;
+
+        memset(&crtc, 0, sizeof(crtc));
+        crtc.crtc_id = _drm.crtc_id;
+        crtc.fb_id = _drm.bufs[page].fb_id;
+        crtc.set_connectors_ptr = (uintptr_t) &_drm.conn_id;
+        crtc.count_connectors = 1;
+        crtc.mode = _drm.mode;
+        crtc.mode_valid = 1;
+
+        if (_drm_ioctl(fb->fd, DRM_IOCTL_MODE_SETCRTC, &crtc) == -1) {
+            err("drm modeset -- %m");
+            return -1;
+        }
+
+        _drm.modeset = true;
+        return 0;
+    }
+
+    if (fb->pages < 2)
+        return 0;
+
+    if (_drm.atomic) {
+        if (_drm_atomic_show(fb->fd, &_drm.bufs[page], false) == -1) {
+            err("drm atomic flip -- %m");
+            _drm.modeset = false;
+            return -1;
+        }
+
+        fb->flip_pending = true;
+        return 0;
+    }
+
+    memset(&flip, 0, sizeof(flip));
+    flip.crtc_id = _drm.crtc_id;
+    flip.fb_id = _drm.bufs[page].fb_id;
+    flip.flags = DRM_MODE_PAGE_FLIP_EVENT;
+
+    /*
+     * The CRTC may not be showing our buffers anymore, e.g. if another
+     * master set its own: set the mode again on the next flush, which is
+     * the single buffered one
+     */
+    if (_drm_ioctl(fb->fd, DRM_IOCTL_MODE_PAGE_FLIP, &flip) == -1) {
+        err("drm page flip -- %m");
+        _drm.modeset = false;
+        return -1;
+    }
+
+    fb->flip_pending = true;
+
+    return 0;
+}
+
+/*
+ * Flip is done: the other page can be drawn to now, so flush whatever
+ * changed while we waited
+ */
+static void _drm_dispatch(int fd)
+{
+    char buf[1024];
+    ssize_t len;
+
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        ssize_t i = 0;
+
+        while (i + (ssize_t) sizeof(struct drm_event) <= len) {
+            struct drm_event ev;
+
+            memcpy(&ev, buf + i, sizeof(ev));
+            if (!ev.length)
+                break;
+            if (ev.type == DRM_EVENT_FLIP_COMPLETE)
+                _drm.fb->flip_pending = false;
+
+            i += ev.length;
+        }
+    }
+
+    ds_fb_flush(_drm.fb);
+}
+
+static int _drm_close(struct ds_fb *fb)
+{
+    int ret = 0, i;
+
+    /*
+     * A CRTC that was off has nothing to give back: it's left to fbcon or
+     * the next client, a modeset with a connector but no fb is rejected
+     */
+    if (_drm.saved_crtc.crtc_id && _drm.saved_crtc.mode_valid &&
+        _drm.saved_crtc.fb_id) {
+        _drm.saved_crtc.set_connectors_ptr = (uintptr_t) &_drm.conn_id;
+        _drm.saved_crtc.count_connectors = 1;
+        if (_drm_ioctl(fb->fd, DRM_IOCTL_MODE_SETCRTC, &_drm.saved_crtc) == -1)
+            inf("restoring crtc -- %m");
+    }
+
+    for (i = 0; i < 2; i++)
+        _drm_buf_destroy(fb->fd, &_drm.bufs[i]);
+    _drm_blob_destroy(fb->fd);
+
+    if (close(fb->fd) == -1) {
+        err("drm closing fd -- %m");
+        ret = -1;
+    }
+
+    if (ds_fs_shutdown() < 0)
+        ret = -1;
+
+    _drm.fb = NULL;
+
+    return ret;
+}
+
+const struct ds_fb_backend ds_fb_backend_drm = {
+    .name = "drm",
+    .open = _drm_open,
+    .query = _drm_query,
+    .map = _drm_map,
+    .flush = _drm_flush,
+    .close = _drm_close,
+    .dispatch = _drm_dispatch,
+};
@@ -0,0 +1,272 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * fb-fbdev.c - Linux framebuffer device backend
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "log.h"
+#include "fb.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fb.h>
+#include <stdbool.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define FBDEV_PATH "/dev/fb0"
+
+static struct fb_fix_screeninfo _finfo;
+static struct fb_var_screeninfo _vinfo;
+static bool _vsync;
+
+/* colormap found on a pseudocolor fb, put back on close */
+static __u16 _saved_cmap[3][256];
+static bool _cmap_saved;
+
+static int _fbdev_open(struct ds_fb *fb)
+{
+    if (ds_fs_setup(FBDEV_PATH) < 0)
+        return -ENODEV;
+
+    fb->fd = open(FBDEV_PATH, O_RDWR | O_CLOEXEC);
+    if (fb->fd < 0) {
+        int ret = -errno;
+
+        crit("open failed -- %m");
+        ds_fs_shutdown();
+        return ret;
+    }
+
+    return 0;
+}
+
+static int _fbdev_query(struct ds_fb *fb)
+{
+    if (ioctl(fb->fd, FBIOGET_FSCREENINFO, &_finfo) == -1) {
+        int ret = -errno;
+
+        crit("reading fb fix info -- %m");
+        return ret;
+    }
+
+    if (_finfo.type != FB_TYPE_PACKED_PIXELS) {
+        crit("don't know how to deal with fb type %d", _finfo.type);
+        return -ENOTSUP;
+    }
+
+    if (ioctl(fb->fd, FBIOGET_VSCREENINFO, &_vinfo) == -1) {
+        int ret = -errno;
+
+        crit("reading fb var info -- %m");
+        return ret;
+    }
+
+    /* dual monitor does not plays well with framebuffer. Logo will be
+     * centralized with regard to visible resolution, so it might not be
+     * centralized in all monitors
+     */
+    if (_vinfo.xres != _vinfo.xres_virtual ||
+        (_vinfo.yres != _vinfo.yres_virtual &&
+         _vinfo.yres_virtual < 2 * _vinfo.yres))
+        wrn("Virtual resolution is not the same of visible one. Logo will be " \
+            "centralized with regard to visible resolution");
+
+    fb->xres = _vinfo.xres;
+    fb->yres = _vinfo.yres;
+    fb->xres_virtual = _vinfo.xres_virtual;
+    fb->yres_virtual = _vinfo.yres_virtual;
+    fb->xoffset = _vinfo.xoffset;
+    fb->yoffset = _vinfo.yoffset;
+    fb->type = _finfo.type;
+    fb->stride = _finfo.line_length;
+    fb->red_length = _vinfo.red.length;
+    fb->red_offset = _vinfo.red.offset;
+    fb->green_length = _vinfo.green.length;
+    fb->green_offset = _vinfo.green.offset;
+    fb->blue_length = _vinfo.blue.length;
+    fb->blue_offset = _vinfo.blue.offset;
+    fb->bits_per_pixel = _vinfo.bits_per_pixel;
+    fb->pseudocolor = _finfo.visual == FB_VISUAL_PSEUDOCOLOR &&
+                      _vinfo.bits_per_pixel == 8;
+
+    inf("FB %s", _finfo.id);
+    inf("FB %dx%d, virtual", _vinfo.xres_virtual, _vinfo.yres_virtual);
+
+    return 0;
+}
+
+static int _fbdev_map(struct ds_fb *fb)
+{
+    fb->screen_size = fb->stride * fb->yres;
+
+    /*
+     * Render to the page that's not being displayed if there's room for two
+     * of them, and flip when done
+     */
+    if (fb->shadow && _vinfo.yres_virtual >= 2 * _vinfo.yres &&
+        _finfo.smem_len >= 2 * fb->screen_size) {
+        fb->pages = 2;
+        fb->front = _vinfo.yoffset >= _vinfo.yres;
+        fb->screen_size *= 2;
+#ifdef ENABLE_VSYNC
+        _vsync = true;
+#endif
+    }
+
+    fb->data = mmap(0, fb->screen_size,
+                    PROT_READ | PROT_WRITE, MAP_SHARED, fb->fd, 0);
+
+    if (fb->data == MAP_FAILED) {
+        int ret = -errno;
+
+        crit("fb mmapping -- %m");
+        fb->data = NULL;
+        return ret;
+    }
+
+    if (fb->pages == 2) {
+        fb->page[0] = fb->data + fb->xoffset * (fb->bits_per_pixel / 8);
+        fb->page[1] = fb->page[0] + fb->yres * fb->stride;
+    } else {
+        fb->page[0] = fb->data + fb->yoffset * fb->stride +
+                      fb->xoffset * (fb->bits_per_pixel / 8);
+    }
+
+    return 0;
+}
+
+/*
+ * Show page @page, waiting for the vertical blank first if the driver lets
+ * us do so
+ */
+static int _fbdev_flush(struct ds_fb *fb, int page)
+{
+    if (fb->pages < 2)
+        return 0;
+
+    if (_vsync) {
+        unsigned int crtc = 0;
+
+        if (ioctl(fb->fd, FBIO_WAITFORVSYNC, &crtc) == -1) {
+            inf("fb can't wait for vsync -- %m");
+            _vsync = false;
+        }
+    }
+
+    _vinfo.xoffset = fb->xoffset;
+    _vinfo.yoffset = page * fb->yres;
+
+    if (ioctl(fb->fd, FBIOPAN_DISPLAY, &_vinfo) == -1)
+        return -errno;
+
+    return 0;
+}
+
+static int _fbdev_set_palette(struct ds_fb *fb, const struct color *colors,
+                              unsigned int n)
+{
+    __u16 red[256], green[256], blue[256];
+    struct fb_cmap cmap = {
+        .start = 0,
+        .len = n,
+        .red = red,
+        .green = green,
+        .blue = blue,
+    };
+    unsigned int i;
+
+    if (!_cmap_saved) {
+        struct fb_cmap old = {
+            .start = 0,
+            .len = 256,
+            .red = _saved_cmap[0],
+            .green = _saved_cmap[1],
+            .blue = _saved_cmap[2],
+        };
+
+        _cmap_saved = ioctl(fb->fd, FBIOGETCMAP, &old) == 0;
+    }
+
+    /* entries are 16 bits wide, of which the driver keeps the top ones */
+    for (i = 0; i < n; i++) {
+        red[i] = colors[i].red * 0x101;
+        green[i] = colors[i].green * 0x101;
+        blue[i] = colors[i].blue * 0x101;
+    }
+
+    if (ioctl(fb->fd, FBIOPUTCMAP, &cmap) == -1) {
+        int ret = -errno;
+
+        err("setting fb colormap -- %m");
+        return ret;
+    }
+
+    return 0;
+}
+
+static int _fbdev_close(struct ds_fb *fb)
+{
+    int ret = 0;
+
+    if (_cmap_saved) {
+        struct fb_cmap old = {
+            .start = 0,
+            .len = 256,
+            .red = _saved_cmap[0],
+            .green = _saved_cmap[1],
+            .blue = _saved_cmap[2],
+        };
+
+        if (ioctl(fb->fd, FBIOPUTCMAP, &old) == -1)
+            wrn("restoring fb colormap -- %m");
+        _cmap_saved = false;
+    }
+
+    // we unmap, and log in case of error, but continue shutting down
+    if (fb->data && munmap(fb->data, fb->screen_size) == -1) {
+        err("fb munmap -- %m");
+        ret = -1;
+    }
+
+    if (close(fb->fd) == -1) {
+        err("fb closing fd -- %m");
+        ret = -1;
+    }
+
+    if (ds_fs_shutdown() < 0)
+        ret = -1;
+
+    return ret;
+}
+
+const struct ds_fb_backend ds_fb_backend_fbdev = {
+    .name = "fbdev",
+    .open = _fbdev_open,
+    .query = _fbdev_query,
+    .map = _fbdev_map,
+    .flush = _fbdev_flush,
+    .close = _fbdev_close,
+    .set_palette = _fbdev_set_palette,
+};
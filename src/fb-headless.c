@@ -0,0 +1,166 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * fb-headless.c - in-memory backend for testing without a display
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+/*
+ * The screen is a memfd described by the environment, so rendering can be
+ * checked and timed on a build box:
+ *
+ *   DIETSPLASH_BACKEND=headless
+ *   DIETSPLASH_HEADLESS=1920x1080:rgb565   (default 1024x768:xrgb8888)
+ *                                          (c8 for a pseudocolor screen)
+ *   DIETSPLASH_SNAPSHOT=/tmp/screen.ppm    (rewritten on every flush)
+ */
+
+#include "log.h"
+#include "fb.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define HEADLESS_DEFAULT_XRES 1024
+#define HEADLESS_DEFAULT_YRES 768
+
+static const char *_snapshot;
+
+static int _headless_open(struct ds_fb *fb)
+{
+    fb->fd = memfd_create("dietsplash", MFD_CLOEXEC);
+    if (fb->fd < 0) {
+        crit("memfd_create -- %m");
+        return -errno;
+    }
+
+    _snapshot = getenv("DIETSPLASH_SNAPSHOT");
+
+    return 0;
+}
+
+static int _headless_query(struct ds_fb *fb)
+{
+    const char *mode = getenv("DIETSPLASH_HEADLESS");
+    enum ds_fb_format format = DS_FB_FORMAT_XRGB8888;
+    int xres = HEADLESS_DEFAULT_XRES, yres = HEADLESS_DEFAULT_YRES;
+
+    if (mode) {
+        char name[16] = "";
+
+        if (sscanf(mode, "%dx%d:%15s", &xres, &yres, name) < 2 ||
+            xres <= 0 || yres <= 0) {
+            crit("invalid headless mode '%s'", mode);
+            return -EINVAL;
+        }
+
+        if (name[0]) {
+            format = ds_blit_format_from_name(name);
+            if (format == DS_FB_FORMAT_GENERIC) {
+                crit("unknown headless pixel format '%s'", name);
+                return -EINVAL;
+            }
+        }
+    }
+
+    /* the colormap is fb->palette, read back by snapshots */
+    if (format == DS_FB_FORMAT_C8) {
+        fb->pseudocolor = true;
+        format = DS_FB_FORMAT_RGB332;
+    }
+
+    ds_blit_format_fill(fb, format);
+    fb->xres = fb->xres_virtual = xres;
+    fb->yres = fb->yres_virtual = yres;
+    fb->xoffset = fb->yoffset = 0;
+    fb->stride = (long) xres * (fb->bits_per_pixel / 8);
+
+    return 0;
+}
+
+static int _headless_map(struct ds_fb *fb)
+{
+    fb->screen_size = fb->stride * fb->yres;
+
+    if (ftruncate(fb->fd, fb->screen_size) == -1) {
+        crit("resizing memfd -- %m");
+        return -errno;
+    }
+
+    fb->data = mmap(0, fb->screen_size,
+                    PROT_READ | PROT_WRITE, MAP_SHARED, fb->fd, 0);
+
+    if (fb->data == MAP_FAILED) {
+        crit("memfd mmapping -- %m");
+        fb->data = NULL;
+        return -errno;
+    }
+
+    fb->page[0] = fb->data;
+
+    return 0;
+}
+
+static int _headless_flush(struct ds_fb *fb, int page)
+{
+    if (_snapshot)
+        ds_fb_snapshot(fb, _snapshot);
+
+    return 0;
+}
+
+static int _headless_set_palette(struct ds_fb *fb, const struct color *colors,
+                                 unsigned int n)
+{
+    return 0;
+}
+
+static int _headless_close(struct ds_fb *fb)
+{
+    int ret = 0;
+
+    if (fb->data && munmap(fb->data, fb->screen_size) == -1) {
+        err("memfd munmap -- %m");
+        ret = -1;
+    }
+
+    if (close(fb->fd) == -1) {
+        err("closing memfd -- %m");
+        ret = -1;
+    }
+
+    return ret;
+}
+
+const struct ds_fb_backend ds_fb_backend_headless = {
+    .name = "headless",
+    .open = _headless_open,
+    .query = _headless_query,
+    .map = _headless_map,
+    .flush = _headless_flush,
+    .close = _headless_close,
+    .set_palette = _headless_set_palette,
+    .manual = true,
+};
@@ -24,31 +24,228 @@
  */
 
 #include "log.h"
+#include "band.h"
+#include "cache.h"
+#include "events.h"
 #include "fb.h"
 #include "pnmtologo.h"
+#include "scale.h"
+#include "stream.h"
+#include "surface.h"
 #include "util.h"
 
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <linux/fb.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #ifdef BACKGROUND_FILE
 static const char *background_filename = BACKGROUND_FILE;
 #else
 #include "background.h"
+#ifdef BACKGROUND_RLE
+#define BACKGROUND_RLE_SIZE ((size_t) (dietsplash_static_background_end - \
+                                       dietsplash_static_background))
 #endif
+#endif
+
+/* around the background */
+static const struct color _bg_color = {
+    (BACKGROUND_COLOR >> 16) & 0xff,
+    (BACKGROUND_COLOR >> 8) & 0xff,
+    BACKGROUND_COLOR & 0xff,
+};
+
+static const struct ds_fb_backend *_backends[] = {
+#ifdef ENABLE_DRM
+    &ds_fb_backend_drm,
+#endif
+    &ds_fb_backend_fbdev,
+#ifdef ENABLE_HEADLESS
+    &ds_fb_backend_headless,
+#endif
+};
+
+static inline bool _rect_touches(const struct ds_rect *a,
+                                 const struct ds_rect *b)
+{
+    return a->x <= b->x + b->w && b->x <= a->x + a->w &&
+           a->y <= b->y + b->h && b->y <= a->y + a->h;
+}
+
+static inline void _rect_union(struct ds_rect *a, const struct ds_rect *b)
+{
+    long x2 = MAX(a->x + a->w, b->x + b->w);
+    long y2 = MAX(a->y + a->h, b->y + b->h);
+
+    a->x = MIN(a->x, b->x);
+    a->y = MIN(a->y, b->y);
+    a->w = x2 - a->x;
+    a->h = y2 - a->y;
+}
+
+/**
+ * Mark a region of the screen as modified, so it's copied to the fb on the
+ * next flush. Overlapping or adjacent regions are merged, and if there are
+ * too many of them everything collapses into their bounding box.
+ */
+void ds_fb_damage(struct ds_fb *fb, long x, long y, long w, long h)
+{
+    struct ds_rect r;
+    int i;
+
+    if (!fb->shadow)
+        return;
+
+    r.x = MAX(x, 0);
+    r.y = MAX(y, 0);
+    r.w = MIN(x + w, (long) fb->xres) - r.x;
+    r.h = MIN(y + h, (long) fb->yres) - r.y;
+    if (r.w <= 0 || r.h <= 0)
+        return;
+
+    /* a merge may make the result touch rects we already went through */
+    for (i = 0; i < fb->n_dirty; ) {
+        if (_rect_touches(&fb->dirty[i], &r)) {
+            _rect_union(&r, &fb->dirty[i]);
+            fb->dirty[i] = fb->dirty[--fb->n_dirty];
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if (fb->n_dirty == DS_FB_MAX_DIRTY) {
+        for (i = 0; i < fb->n_dirty; i++)
+            _rect_union(&r, &fb->dirty[i]);
+        fb->n_dirty = 0;
+    }
+
+    fb->dirty[fb->n_dirty++] = r;
+}
+
+static void _fb_copy_rects(struct ds_fb *fb, const struct ds_rect *rects,
+                           int n, char *page)
+{
+    int i, bytes_per_pixel = fb->bits_per_pixel / 8;
+
+    for (i = 0; i < n; i++) {
+        const struct ds_rect *r = &rects[i];
+        long j, len = r->w * bytes_per_pixel;
+        const char *src = fb->shadow + r->y * fb->stride +
+                          r->x * bytes_per_pixel;
+        char *dst = page + r->y * fb->stride + r->x * bytes_per_pixel;
+
+        for (j = 0; j < r->h; j++, src += fb->stride, dst += fb->stride)
+            memcpy(dst, src, len);
+    }
+}
+
+/**
+ * Copy the regions modified since the last flush from the shadow buffer to
+ * the fb memory. The mapping is only written, never read back.
+ *
+ * When double buffering, the back page also gets the regions that changed
+ * in the previous frame, since it missed them, and is then put on screen.
+ */
+void ds_fb_flush(struct ds_fb *fb)
+{
+    struct ds_rect dirty[DS_FB_MAX_DIRTY];
+    int i, n, back;
+
+    /* changes pile up until the pending flip is done */
+    if (!fb->shadow || !fb->n_dirty || fb->flip_pending)
+        return;
+
+    if (fb->pages < 2) {
+        _fb_copy_rects(fb, fb->dirty, fb->n_dirty, fb->page[fb->front]);
+        fb->n_dirty = 0;
+        fb->backend->flush(fb, fb->front);
+        return;
+    }
+
+    n = fb->n_dirty;
+    memcpy(dirty, fb->dirty, n * sizeof(*dirty));
+    for (i = 0; i < fb->n_stale; i++)
+        ds_fb_damage(fb, fb->stale[i].x, fb->stale[i].y,
+                     fb->stale[i].w, fb->stale[i].h);
+
+    back = !fb->front;
+    _fb_copy_rects(fb, fb->dirty, fb->n_dirty, fb->page[back]);
+
+    /*
+     * Keep drawing to the page still on screen. The backend is told about
+     * it, since it may have to put it on screen again.
+     */
+    if (fb->backend->flush(fb, back) < 0) {
+        wrn("page flip failed, falling back to single buffer -- %m");
+        fb->pages = 1;
+        _fb_copy_rects(fb, fb->dirty, fb->n_dirty, fb->page[fb->front]);
+        fb->n_dirty = 0;
+        fb->backend->flush(fb, fb->front);
+        return;
+    }
+
+    fb->front = back;
+    memcpy(fb->stale, dirty, n * sizeof(*dirty));
+    fb->n_stale = n;
+    fb->n_dirty = 0;
+}
+
+void ds_fb_fill(struct ds_fb *fb, long x, long y, long w, long h,
+                const struct color *color)
+{
+    unsigned char pattern[DS_BLIT_PATTERN_LEN];
+    long j, x2 = MIN(x + w, (long) fb->xres), y2 = MIN(y + h, (long) fb->yres);
+    char *dst;
+
+    x = MAX(x, 0);
+    y = MAX(y, 0);
+    if (x >= x2 || y >= y2)
+        return;
+
+    dst = ds_fb_pixel(fb, x, y);
+    for (j = y; j < y2; j++, dst += fb->stride) {
+        ds_blit_pattern(fb, color, x, j, pattern);
+        ds_blit_fill_row(dst, pattern, (x2 - x) * (fb->bits_per_pixel / 8));
+    }
+
+    ds_fb_damage(fb, x, y, x2 - x, y2 - y);
+}
+
+struct region_job {
+    const struct ds_fb *fb;
+    const struct image *region;
+    char *dst;
+    long width;
+};
+
+static int _fb_draw_region_band(void *data, long start, long end)
+{
+    const struct region_job *job = data;
+    const struct ds_fb *fb = job->fb;
+    const struct image *region = job->region;
+    char *dst = job->dst + start * fb->stride;
+    long j;
+
+    for (j = start; j < end; j++, dst += fb->stride)
+        fb->blit_row(fb, dst, region->pixels + j * region->width,
+                     job->width, j);
+
+    return 0;
+}
 
 void ds_fb_draw_region(struct ds_fb *fb, const struct image *region,
                        float xalign, float yalign)
 {
-    long i, j, xoffset, yoffset;
+    struct region_job job;
+    long xoffset, yoffset;
     long w = region->width;
     long h = region->height;
 
@@ -68,143 +265,630 @@ void ds_fb_draw_region(struct ds_fb *fb, const struct image *region,
     xoffset = (long)((fb->xres - w) * xalign);
     yoffset = (long)((fb->yres - h) * yalign);
 
-    for (j = 0; j < h; j++) {
-        for (i = 0; i < w; i++) {
-            long location = ((i + fb->xoffset + xoffset) * (fb->bits_per_pixel / 8)) +
-                            (j + fb->yoffset + yoffset) * fb->stride;
+    job.fb = fb;
+    job.region = region;
+    job.dst = ds_fb_pixel(fb, xoffset, yoffset);
+    job.width = w;
+    ds_band_run(h, w, _fb_draw_region_band, &job);
 
-            long pixel = (region->pixels[j * w + i].blue >> (8-fb->blue_length)) | 
-                         ((region->pixels[j * w + i].green >> (8-fb->green_length)) << fb->green_offset) | 
-                         ((region->pixels[j * w + i].red >> (8-fb->red_length)) << fb->red_offset);
+    ds_fb_damage(fb, xoffset, yoffset, w, h);
+}
 
-            int k;
-            for(k = 0; k < fb->bits_per_pixel/8; k++) {
-                *(fb->data + location + k ) = pixel >> k*8;
-            }
+struct indexed_job {
+    const struct ds_fb *fb;
+    const struct indexed_image *img;
+    const struct ds_blit_palette *palette;
+    char *dst;
+    long width;
+};
+
+static int _fb_draw_indexed_band(void *data, long start, long end)
+{
+    const struct indexed_job *job = data;
+    const struct ds_fb *fb = job->fb;
+    char *dst = job->dst + start * fb->stride;
+    long j;
+
+    for (j = start; j < end; j++, dst += fb->stride)
+        ds_blit_indexed_row(job->palette, dst,
+                            job->img->pixels + j * job->img->width,
+                            job->width, j);
+
+    return 0;
+}
+
+/**
+ * Same as ds_fb_draw_region(), for an indexed image. Each pixel is a lookup
+ * in its palette converted once, or a plain copy if the fb is pseudocolor
+ * with that palette.
+ */
+void ds_fb_draw_indexed(struct ds_fb *fb, const struct indexed_image *img,
+                        float xalign, float yalign)
+{
+    struct indexed_job job;
+    struct ds_blit_palette *palette;
+    long xoffset, yoffset;
+    long w = MIN((long) img->width, (long) fb->xres);
+    long h = MIN((long) img->height, (long) fb->yres);
+
+    assert(fb);
+    assert(img);
+
+    palette = malloc(sizeof(*palette));
+    if (!palette) {
+        err("allocating palette -- %m");
+        return;
+    }
+
+    ds_blit_palette_init(fb, img->palette, img->colors, palette);
+
+    xoffset = (long)((fb->xres - w) * xalign);
+    yoffset = (long)((fb->yres - h) * yalign);
+
+    job.fb = fb;
+    job.img = img;
+    job.palette = palette;
+    job.dst = ds_fb_pixel(fb, xoffset, yoffset);
+    job.width = w;
+    ds_band_run(h, w, _fb_draw_indexed_band, &job);
+
+    free(palette);
+
+    ds_fb_damage(fb, xoffset, yoffset, w, h);
+}
+
+/**
+ * Program the colormap of a pseudocolor fb with @colors, or with the RGB332
+ * color cube if @colors is NULL. Anything drawn afterwards with other
+ * colors than those of the palette gets the closest one, so images using
+ * it should be drawn with ds_fb_draw_indexed() or from a surface made by
+ * ds_surface_new_from_indexed(). What's on screen is not redrawn.
+ *
+ * @return 0 on success or a negative errno, -ENOTSUP if @fb has no colormap
+ */
+int ds_fb_set_palette(struct ds_fb *fb, const struct color *colors,
+                      unsigned int n)
+{
+    struct color cube[256];
+    unsigned int i;
+    int ret;
+
+    if (!fb->pseudocolor || !fb->backend->set_palette)
+        return -ENOTSUP;
+
+    if (!colors) {
+        for (i = 0; i < ARRAY_SIZE(cube); i++) {
+            cube[i].red = (i >> 5) * 255 / 7;
+            cube[i].green = ((i >> 2) & 7) * 255 / 7;
+            cube[i].blue = (i & 3) * 255 / 3;
         }
+        colors = cube;
+        n = ARRAY_SIZE(cube);
+    }
+
+    n = MIN(n, ARRAY_SIZE(fb->palette));
+    ret = fb->backend->set_palette(fb, colors, n);
+    if (ret < 0)
+        return ret;
+
+    memcpy(fb->palette, colors, n * sizeof(*colors));
+    fb->palette_len = n;
+
+    if (colors == cube)
+        ds_blit_format_fill(fb, DS_FB_FORMAT_RGB332);
+    else
+        fb->format = DS_FB_FORMAT_C8;
+
+    fb->blit_row = ds_blit_row_func_get(fb);
+
+    return 0;
+}
+
+/*
+ * On a pseudocolor fb, show @img with its own colors, plus the one around
+ * it if there's room, so it's drawn without any conversion
+ */
+static void _fb_bg_palette(struct ds_fb *fb, const struct indexed_image *img)
+{
+    struct color colors[256];
+    unsigned int i, n = img->colors;
+
+    memcpy(colors, img->palette, n * sizeof(*colors));
+
+    for (i = 0; i < n; i++)
+        if (!memcmp(&colors[i], &_bg_color, sizeof(_bg_color)))
+            break;
+
+    if (i == n && n < ARRAY_SIZE(colors))
+        colors[n++] = _bg_color;
+
+    if (ds_fb_set_palette(fb, colors, n) < 0)
+        wrn("fb colormap not set, background drawn with the color cube");
+}
+
+/*
+ * Paint the bands around a centered @w x @h background, leaving the area it
+ * covers untouched
+ */
+static void _fb_draw_letterbox(struct ds_fb *fb, long w, long h)
+{
+    long x, y;
+
+    w = MIN(w, (long) fb->xres);
+    h = MIN(h, (long) fb->yres);
+    x = (fb->xres - w) / 2;
+    y = (fb->yres - h) / 2;
+
+    fb->bg_area.x = x;
+    fb->bg_area.y = y;
+    fb->bg_area.w = w;
+    fb->bg_area.h = h;
+
+    ds_fb_fill(fb, 0, 0, fb->xres, y, &_bg_color);
+    ds_fb_fill(fb, 0, y + h, fb->xres, fb->yres - y - h, &_bg_color);
+    ds_fb_fill(fb, 0, y, x, h, &_bg_color);
+    ds_fb_fill(fb, x + w, y, fb->xres - x - w, h, &_bg_color);
+}
+
+/* scaling asked by DIETSPLASH_SCALE, or by the build default */
+static void _fb_scale_get(enum ds_scale_mode *mode,
+                          enum ds_scale_filter *filter)
+{
+    const char *spec = getenv("DIETSPLASH_SCALE");
+
+    if (!spec)
+        spec = BACKGROUND_SCALE;
+
+    if (ds_scale_parse(spec, mode, filter) < 0) {
+        wrn("unknown scaling '%s', keeping the image size", spec);
+        *mode = DS_SCALE_NONE;
+        *filter = DS_SCALE_BILINEAR;
     }
 }
 
-static void _fb_draw_bg(struct ds_fb *fb)
+#ifdef BACKGROUND_FORMAT
+/*
+ * The background was converted at build time. It can be drawn as is if the
+ * screen uses the same format and no scaling changes its size.
+ */
+static bool _fb_bg_static_fits(const struct ds_fb *fb,
+                               enum ds_scale_mode mode)
+{
+    const struct ds_surface *bg = &dietsplash_static_background;
+    long w = bg->width, h = bg->height;
+
+    if (fb->format != ds_blit_format_from_name(BACKGROUND_FORMAT)) {
+        inf("screen is %s, converting background built for %s",
+            ds_blit_format_name(fb->format), BACKGROUND_FORMAT);
+        return false;
+    }
+
+    ds_scale_size(fb, mode, &w, &h);
+
+    return w == bg->width && h == bg->height;
+}
+#endif
+
+#ifdef CACHE_DIR
+static struct ds_surface *_fb_bg_cache_lookup(struct ds_fb *fb,
+                                              enum ds_scale_mode mode,
+                                              enum ds_scale_filter filter)
 {
-    struct image *bg;
+    unsigned int scale = mode << 8 | filter;
 
 #ifdef BACKGROUND_FILE
-    bg = ds_read_image(background_filename);
+    return ds_cache_lookup(fb, background_filename, 0, scale);
 #else
-    bg = &dietsplash_static_background;
+    return ds_cache_lookup(fb, NULL, DIETSPLASH_STATIC_BACKGROUND_HASH, scale);
+#endif
+}
 #endif
 
+#if defined(ENABLE_STREAM) && !defined(BACKGROUND_FORMAT)
+/*
+ * Draw the background while it's decoded, a few rows at a time, if it needs
+ * no scaling. Nothing is kept around.
+ *
+ * @return 0 if it was drawn, even partially, or a negative errno if the
+ * background can't be streamed
+ */
+static int _fb_draw_bg_stream(struct ds_fb *fb, enum ds_scale_mode mode)
+{
+#if defined(BACKGROUND_FILE) || defined(BACKGROUND_RLE)
+    struct ds_image_stream *stream;
+    unsigned int width, height;
+    long w, h;
+    int ret;
+
+#ifdef BACKGROUND_FILE
+    stream = ds_image_stream_open(background_filename);
+#else
+    stream = ds_image_stream_new(dietsplash_static_background,
+                                 BACKGROUND_RLE_SIZE);
+#endif
+    if (!stream)
+        return -errno;
+
+    ds_image_stream_size(stream, &width, &height);
+    w = width;
+    h = height;
+    ds_scale_size(fb, mode, &w, &h);
+    if (w != width || h != height) {
+        ds_image_stream_close(stream);
+        return -ENOTSUP;
+    }
+
+    _fb_draw_letterbox(fb, width, height);
+    ret = ds_fb_draw_stream(fb, stream, 0.5, 0.5);
+    ds_image_stream_close(stream);
+
+    if (ret < 0)
+        err("decoding background -- %s", strerror(-ret));
+#else
+    /* already in memory, converted straight from there */
+#ifdef BACKGROUND_INDEXED
+    const struct indexed_image *bg = &dietsplash_static_background;
+#else
+    const struct image *bg = &dietsplash_static_background;
+#endif
+    long w = bg->width, h = bg->height;
+
+    ds_scale_size(fb, mode, &w, &h);
+    if (w != bg->width || h != bg->height)
+        return -ENOTSUP;
+
+#ifdef BACKGROUND_INDEXED
+    if (fb->pseudocolor)
+        _fb_bg_palette(fb, bg);
+
+    _fb_draw_letterbox(fb, bg->width, bg->height);
+    ds_fb_draw_indexed(fb, bg, 0.5, 0.5);
+#else
+    _fb_draw_letterbox(fb, bg->width, bg->height);
     ds_fb_draw_region(fb, bg, 0.5, 0.5);
+#endif
+#endif
+
+    ds_fb_flush(fb);
+
+    return 0;
+}
+#endif
+
+/*
+ * Convert the background once to the fb format and keep it around, so
+ * redrawing it is only a copy
+ */
+static void _fb_draw_bg(struct ds_fb *fb)
+{
+    enum ds_scale_mode mode;
+    enum ds_scale_filter filter;
+    const struct image *bg = NULL;
+    const struct indexed_image *indexed = NULL;
+    struct image *decoded = NULL;
+    struct indexed_image *reduced = NULL;
+
+    _fb_scale_get(&mode, &filter);
+
+#ifdef BACKGROUND_FORMAT
+    /* never written to, nor freed */
+    if (_fb_bg_static_fits(fb, mode)) {
+        fb->bg = (struct ds_surface *) &dietsplash_static_background;
+        _fb_draw_letterbox(fb, fb->bg->width, fb->bg->height);
+        ds_fb_draw_surface(fb, fb->bg, 0.5, 0.5);
+        ds_fb_flush(fb);
+        return;
+    }
+#endif
+
+#if defined(ENABLE_STREAM) && !defined(BACKGROUND_FORMAT)
+    if (_fb_draw_bg_stream(fb, mode) == 0)
+        return;
+#endif
+
+#ifdef CACHE_DIR
+    /* the colormap a surface was made for is not part of the key */
+    if (!fb->pseudocolor)
+        fb->bg = _fb_bg_cache_lookup(fb, mode, filter);
+    if (fb->bg) {
+        _fb_draw_letterbox(fb, fb->bg->width, fb->bg->height);
+        ds_fb_draw_surface(fb, fb->bg, 0.5, 0.5);
+        ds_fb_flush(fb);
+        /* the file was only touched: store its new size, mtime and inode */
+        if (ds_cache_save(fb->bg) < 0)
+            dbg("background cache not written yet -- %m");
+        return;
+    }
+#endif
 
 #ifdef BACKGROUND_FILE
-    free(bg);
+    /* RLE files that need no scaling are expanded right into the surface */
+    if (mode == DS_SCALE_NONE)
+        fb->bg = ds_surface_new_from_rle(fb, background_filename);
+
+    if (!fb->bg) {
+        bg = decoded = ds_read_image(background_filename);
+        if (!bg)
+            err("reading %s -- %m", background_filename);
+    }
+#elif defined(BACKGROUND_RLE)
+    if (mode == DS_SCALE_NONE)
+        fb->bg = ds_surface_new_from_rle_data(fb, dietsplash_static_background,
+                                              BACKGROUND_RLE_SIZE);
+
+    if (!fb->bg) {
+        bg = decoded = ds_read_image_data(dietsplash_static_background,
+                                          BACKGROUND_RLE_SIZE);
+        if (!bg)
+            err("decoding static background -- %m");
+    }
+#elif defined(BACKGROUND_FORMAT)
+    bg = decoded = ds_surface_to_image(&dietsplash_static_background,
+                                       ds_blit_format_from_name(
+                                           BACKGROUND_FORMAT));
+    if (!bg)
+        err("unpacking static background -- %m");
+#elif defined(BACKGROUND_INDEXED)
+    indexed = &dietsplash_static_background;
+#else
+    bg = &dietsplash_static_background;
 #endif
+
+    /* a pseudocolor fb shows an image of few enough colors as it is */
+    if (fb->pseudocolor && !fb->bg && bg && mode == DS_SCALE_NONE)
+        indexed = reduced = ds_image_index(bg);
+
+    if (indexed && mode == DS_SCALE_NONE) {
+        if (fb->pseudocolor)
+            _fb_bg_palette(fb, indexed);
+        fb->bg = ds_surface_new_from_indexed(fb, indexed);
+    } else if (indexed) {
+        bg = decoded = ds_indexed_to_image(indexed);
+        if (!bg)
+            err("expanding static background -- %m");
+    }
+
+    if (!fb->bg && !bg && !indexed) {
+        _fb_draw_letterbox(fb, 0, 0);
+        ds_fb_flush(fb);
+        return;
+    }
+
+    if (!fb->bg && bg)
+        fb->bg = ds_surface_new_scaled(fb, bg, mode, filter);
+
+    if (fb->bg) {
+        _fb_draw_letterbox(fb, fb->bg->width, fb->bg->height);
+        ds_fb_draw_surface(fb, fb->bg, 0.5, 0.5);
+    } else if (bg) {
+        _fb_draw_letterbox(fb, bg->width, bg->height);
+        ds_fb_draw_region(fb, bg, 0.5, 0.5);
+    } else {
+        _fb_draw_letterbox(fb, indexed->width, indexed->height);
+        ds_fb_draw_indexed(fb, indexed, 0.5, 0.5);
+    }
+
+    ds_fb_flush(fb);
+
+#ifdef CACHE_DIR
+    /* most likely the root filesystem is read-only, retried on shutdown */
+    if (fb->bg && ds_cache_save(fb->bg) < 0)
+        dbg("background cache not written yet -- %m");
+#endif
+
+    free(decoded);
+    free(reduced);
 }
 
-int ds_fb_init(struct ds_fb *ds_fb)
+/**
+ * Write what's currently on screen to @filename as a binary PPM
+ *
+ * @return 0 on success or -1 on error
+ */
+int ds_fb_snapshot(const struct ds_fb *fb, const char *filename)
 {
-    int ret = 0, fd;
-    struct fb_fix_screeninfo finfo;
-    struct fb_var_screeninfo vinfo;
+    int bytes_per_pixel = fb->bits_per_pixel / 8;
+    unsigned int rmax = (1 << fb->red_length) - 1;
+    unsigned int gmax = (1 << fb->green_length) - 1;
+    unsigned int bmax = (1 << fb->blue_length) - 1;
+    long i, j;
+    FILE *fp;
+
+    fp = fopen(filename, "w");
+    if (!fp) {
+        err("opening snapshot %s -- %m", filename);
+        return -1;
+    }
 
-    ret = ds_fs_setup("/dev/fb0");
-    if (ret < 0)
-        goto ret_on_err;
+    fprintf(fp, "P6\n%d %d\n255\n", fb->xres, fb->yres);
+
+    for (j = 0; j < fb->yres; j++) {
+        const unsigned char *p = (unsigned char *) fb->page[fb->front] +
+                                 j * fb->stride;
+
+        for (i = 0; i < fb->xres; i++, p += bytes_per_pixel) {
+            uint32_t v = 0;
+            int k;
+
+            if (fb->format == DS_FB_FORMAT_C8) {
+                fwrite(&fb->palette[*p], sizeof(struct color), 1, fp);
+                continue;
+            }
+
+            for (k = 0; k < bytes_per_pixel; k++)
+                v |= (uint32_t) p[k] << k * 8;
+
+            fputc(((v >> fb->red_offset) & rmax) * 255 / rmax, fp);
+            fputc(((v >> fb->green_offset) & gmax) * 255 / gmax, fp);
+            fputc(((v >> fb->blue_offset) & bmax) * 255 / bmax, fp);
+        }
+    }
 
-    fd = open("/dev/fb0", O_RDWR);
-    if (fd < 0) {
-        crit("open failed -- %m");
-        ret = -errno;
-        goto ret_on_err;
+    if (fclose(fp) == EOF) {
+        err("writing snapshot %s -- %m", filename);
+        return -1;
     }
 
-    if (ioctl(fd, FBIOGET_FSCREENINFO, &finfo) == -1) {
-        crit("reading fb fix info -- %m");
-        ret = -errno;
-        goto close_on_err;
+    return 0;
+}
+
+static int _fb_backend_open(struct ds_fb *fb,
+                            const struct ds_fb_backend *backend)
+{
+    int ret;
+
+    fb->backend = backend;
+
+    ret = backend->open(fb);
+    if (ret < 0)
+        return ret;
+
+    ret = backend->query(fb);
+    if (ret) {
+        backend->close(fb);
+        return ret;
     }
 
-    if (finfo.type != FB_TYPE_PACKED_PIXELS) {
-        crit("don't know how to deal with fb type %d", finfo.type);
-        ret = 1;
-        goto close_on_err;
+    return 0;
+}
+
+/*
+ * Use the backend named in DIETSPLASH_BACKEND or the first one that
+ * works, in order of preference
+ */
+static int _fb_backend_probe(struct ds_fb *fb)
+{
+    const char *name = getenv("DIETSPLASH_BACKEND");
+    unsigned int i;
+    int ret = -ENODEV;
+
+    for (i = 0; i < ARRAY_SIZE(_backends); i++) {
+        if (name && strcmp(_backends[i]->name, name))
+            continue;
+        if (!name && _backends[i]->manual)
+            continue;
+
+        ret = _fb_backend_open(fb, _backends[i]);
+        if (!ret || name)
+            return ret;
     }
 
-    if (ioctl(fd, FBIOGET_VSCREENINFO, &vinfo) == -1) {
-        crit("reading fb var info -- %m");
-        ret = -errno;
-        goto close_on_err;
+    if (name)
+        crit("unknown backend %s", name);
+
+    return ret;
+}
+
+int ds_fb_init(struct ds_fb *ds_fb)
+{
+    long bands;
+    int ret;
+
+    ds_fb->fd = -1;
+    ds_fb->pages = 1;
+    ds_fb->front = 0;
+    ds_fb->flip_pending = false;
+    ds_fb->n_dirty = 0;
+    ds_fb->n_stale = 0;
+
+    ds_fb->pseudocolor = false;
+    ds_fb->palette_len = 0;
+
+    ret = _fb_backend_probe(ds_fb);
+    if (ret)
+        return ret;
+
+    /* drawn as RGB332 until the background brings its own colors */
+    if (ds_fb->pseudocolor) {
+        ds_blit_format_fill(ds_fb, DS_FB_FORMAT_RGB332);
+        if (ds_fb_set_palette(ds_fb, NULL, 0) < 0)
+            wrn("fb colormap not set, colors will be wrong");
     }
 
-    /* dual monitor does not plays well with framebuffer. Logo will be
-     * centralized with regard to visible resolution, so it might not be
-     * centralized in all monitors
-     */
-    if (vinfo.xres != vinfo.xres_virtual || vinfo.yres != vinfo.yres_virtual)
-        wrn("Virtual resolution is not the same of visible one. Logo will be " \
-            "centralized with regard to visible resolution");
-
-    ds_fb->xres = vinfo.xres;
-    ds_fb->yres = vinfo.yres;
-    ds_fb->xres_virtual = vinfo.xres_virtual;
-    ds_fb->yres_virtual = vinfo.yres_virtual;
-    ds_fb->xoffset = vinfo.xoffset;
-    ds_fb->yoffset = vinfo.yoffset;
-    ds_fb->type = finfo.type;
-    ds_fb->stride = finfo.line_length;
-    ds_fb->screen_size = ds_fb->stride * ds_fb->yres;
-    ds_fb->red_length = vinfo.red.length;
-    ds_fb->red_offset = vinfo.red.offset;
-    ds_fb->green_length = vinfo.green.length;
-    ds_fb->green_offset = vinfo.green.offset;
-    ds_fb->blue_length = vinfo.blue.length;
-    ds_fb->blue_offset = vinfo.blue.offset;
-    ds_fb->bits_per_pixel = vinfo.bits_per_pixel;
-
-    inf("FB %s", finfo.id);
-    inf("FB %dx%d, %dbpp", vinfo.xres, vinfo.yres, vinfo.bits_per_pixel);
-    inf("FB %dx%d, virtual", vinfo.xres_virtual, vinfo.yres_virtual);
-
-    ds_fb->data = mmap(0, ds_fb->screen_size,
-                       PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-
-    if (ds_fb->data == MAP_FAILED) {
-        crit("fb mmapping -- %m");
-        ret = -errno;
-        goto close_on_err;
-    }
-
-    if (close(fd) == -1)
-        err("fb closing fd -- %m");
+    ds_fb->format = ds_blit_format_detect(ds_fb);
+    ds_fb->blit_row = ds_blit_row_func_get(ds_fb);
+
+    inf("FB backend %s", ds_fb->backend->name);
+    inf("FB %dx%d, %dbpp", ds_fb->xres, ds_fb->yres, ds_fb->bits_per_pixel);
+    inf("FB format %s", ds_blit_format_name(ds_fb->format));
+
+    /* started once, the same threads convert every image from now on */
+    bands = ds_band_init(ds_band_cpus());
+    if (bands > 1)
+        inf("FB converting in %ld threads", bands);
+
+    /* if there's no memory for it, we just draw directly on the fb */
+    ds_fb->shadow = calloc(1, ds_fb->stride * ds_fb->yres);
+    if (!ds_fb->shadow)
+        wrn("no shadow buffer, drawing directly to fb -- %m");
+
+    ret = ds_fb->backend->map(ds_fb);
+    if (ret < 0)
+        goto free_on_err;
+
+    if (ds_fb->pages == 2) {
+        inf("FB double buffering");
+
+        /* neither page has our content yet */
+        ds_fb_damage(ds_fb, 0, 0, ds_fb->xres, ds_fb->yres);
+        ds_fb->stale[0] = ds_fb->dirty[0];
+        ds_fb->n_stale = 1;
+    }
 
     _fb_draw_bg(ds_fb);
 
     return 0;
 
-close_on_err:
-    close(fd);
-ret_on_err:
+free_on_err:
+    ds_band_shutdown();
+    free(ds_fb->shadow);
+    ds_fb->shadow = NULL;
+    ds_fb->data = NULL;
+    ds_fb->backend->close(ds_fb);
     return ret;
 }
 
+/**
+ * Let the backend receive events from the main loop, if it needs them. Must
+ * be called after ds_events_init().
+ */
+int ds_fb_watch(struct ds_fb *fb)
+{
+    if (!fb->backend->dispatch)
+        return 0;
+
+    return ds_events_watch(fb->fd, fb->backend->dispatch);
+}
+
 int ds_fb_shutdown(struct ds_fb *ds_fb)
 {
-    int ret = 0;
+    int ret;
     assert(ds_fb);
     assert(ds_fb->data);
 
-    // we unmap, and log in case of error, but continue shutting down
-    if(munmap(ds_fb->data, ds_fb->screen_size) == -1) {
-        err("fb munmap -- %m");
-        ret = -1;
-    }
+#ifdef CACHE_DIR
+    if (ds_fb->bg)
+        ds_cache_save(ds_fb->bg);
+#endif
+
+    ds_band_shutdown();
+    ret = ds_fb->backend->close(ds_fb);
 
     ds_fb->data = NULL;
     ds_fb->screen_size = 0;
+    ds_fb->fd = -1;
+
+    free(ds_fb->shadow);
+    ds_fb->shadow = NULL;
+    ds_fb->n_dirty = 0;
+    ds_fb->n_stale = 0;
 
-    if (ds_fs_shutdown() < 0)
-        ret = -1;
+#ifdef BACKGROUND_FORMAT
+    if (ds_fb->bg == &dietsplash_static_background)
+        ds_fb->bg = NULL;
+#endif
+    ds_surface_free(ds_fb->bg);
+    ds_fb->bg = NULL;
 
     return ret;
 }
@@ -26,9 +26,63 @@
 #ifndef __DIETSPLASH_FB_H
 #define __DIETSPLASH_FB_H
 
+#include "blit.h"
+#include "pnmtologo.h"
+
 #include <stdbool.h>
 
+struct ds_fb;
+struct ds_surface;
+
+/*
+ * Display backends. All of them return 0 on success or a negative errno.
+ *
+ * @open: acquire the device and store its fd in fb->fd
+ * @query: fill geometry and pixel format fields
+ * @map: set fb->data and the origin of each page, possibly two of them
+ * @flush: called after fb memory was updated; put @page on screen. Backends
+ *         that flip asynchronously set fb->flip_pending and call
+ *         ds_fb_flush() again once the flip is done. When a flip fails,
+ *         drawing goes on single buffered to fb->page[fb->front], which is
+ *         then the @page given.
+ * @close: unmap and release everything acquired by open and map
+ * @dispatch: optional, handle events on fb->fd from the main loop
+ * @set_palette: optional, program the first @n entries of the colormap of
+ *               a pseudocolor fb
+ */
+struct ds_fb_backend {
+    const char *name;
+    int (*open)(struct ds_fb *fb);
+    int (*query)(struct ds_fb *fb);
+    int (*map)(struct ds_fb *fb);
+    int (*flush)(struct ds_fb *fb, int page);
+    int (*close)(struct ds_fb *fb);
+    void (*dispatch)(int fd);
+    int (*set_palette)(struct ds_fb *fb, const struct color *colors,
+                       unsigned int n);
+    /* only used when asked for by name */
+    bool manual;
+};
+
+#ifdef ENABLE_DRM
+extern const struct ds_fb_backend ds_fb_backend_drm;
+#endif
+extern const struct ds_fb_backend ds_fb_backend_fbdev;
+#ifdef ENABLE_HEADLESS
+extern const struct ds_fb_backend ds_fb_backend_headless;
+#endif
+
+struct ds_rect {
+    long x;
+    long y;
+    long w;
+    long h;
+};
+
+#define DS_FB_MAX_DIRTY 16
+
 struct ds_fb {
+    const struct ds_fb_backend *backend;
     long screen_size;
     long stride;
     int xres;
@@ -45,12 +99,54 @@ struct ds_fb {
     int green_offset;
     int blue_length;
     int blue_offset;
+    enum ds_fb_format format;
+    ds_blit_row_func blit_row;
+    /* 8bpp with a colormap, set by the query of the backend */
+    bool pseudocolor;
+    struct color palette[256];
+    unsigned int palette_len;
     char *data;
+    /* system RAM copy of the visible page, flushed to data when dirty */
+    char *shadow;
+    struct ds_rect dirty[DS_FB_MAX_DIRTY];
+    int n_dirty;
+    /* double buffering: the page not shown lags behind by stale rects */
+    int fd;
+    int pages;
+    int front;
+    char *page[2];
+    bool flip_pending;
+    struct ds_rect stale[DS_FB_MAX_DIRTY];
+    int n_stale;
+    struct ds_surface *bg;
+    /*
+     * Visible part of the background, however it was drawn, scaled or
+     * centered. Whatever goes over or around it is placed relative to this.
+     */
+    struct ds_rect bg_area;
 };
 
-struct image;
+/*
+ * Address of pixel (@x, @y) in the buffer drawing operations should write to
+ */
+static inline char *ds_fb_pixel(const struct ds_fb *fb, long x, long y)
+{
+    char *base = fb->shadow ? fb->shadow : fb->page[fb->front];
+
+    return base + y * fb->stride + x * (fb->bits_per_pixel / 8);
+}
 
+void ds_fb_damage(struct ds_fb *fb, long x, long y, long w, long h);
+void ds_fb_flush(struct ds_fb *fb);
+void ds_fb_fill(struct ds_fb *fb, long x, long y, long w, long h,
+                const struct color *color);
 void ds_fb_draw_region(struct ds_fb *fb, const struct image *region, float xalign, float yalign);
+void ds_fb_draw_indexed(struct ds_fb *fb, const struct indexed_image *img,
+                        float xalign, float yalign);
+int ds_fb_set_palette(struct ds_fb *fb, const struct color *colors,
+                      unsigned int n);
+int ds_fb_watch(struct ds_fb *fb);
+int ds_fb_snapshot(const struct ds_fb *fb, const char *filename);
 int ds_fb_init(struct ds_fb *ds_fb);
 int ds_fb_shutdown(struct ds_fb *ds_fb);
 
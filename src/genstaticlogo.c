@@ -4,7 +4,7 @@
  *
  * Copyright (C) 2010 ProFUSION embedded systems
  *
- * genstaticlogo.c - generate C source structs from images
+ * genstaticlogo.c - generate headers embedding images in the binary
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published
@@ -23,14 +23,69 @@
  *
  */
 
+#include "fb.h"
 #include "pnmtologo.h"
+#include "rle.h"
+#include "surface.h"
 #include "util.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <string.h>
 
-static const char *USAGE = "USAGE: genstaticlogo static_struct_name outfile.c file1.ppm [ file2.ppm ... ]";
+/*
+ * Pixels are not written as C initializers, which take ages to compile for
+ * large images, but to a binary file next to the header. The header pulls
+ * it into .rodata with an .incbin directive. With -r the file is RLE
+ * encoded and only expanded when drawing. With -f the pixels are converted
+ * to the given framebuffer format and, with the fields written before them
+ * in the header, make a struct ds_surface drawn without any conversion on a
+ * matching screen. -e gives the byte order of the target, big or little,
+ * for pixels stored as 16 or 32-bit words, if it's not the one of the host. With -i images become
+ * a struct indexed_image, a third of the size, if they have at most 256
+ * colors.
+ *
+ * A single image also gets <NAME>_HASH, the hash of its file and size, so
+ * that the background cache can know it without reading it at boot.
+ *
+ * With -d the images are the frames of an animation, all of the same size,
+ * and <name> is an atlas of every pixel it shows: the first frame, at the
+ * top left as <name>_first says, then the rects of <name>_rects, where a
+ * frame differs from the one before it. <name>_deltas tells which rects
+ * make each frame, the first one coming after the last. With -i the atlas
+ * is indexed, so all frames share a palette.
+ *
+ * With -t the single image is a font sheet: FONT_COLUMNS glyphs per row,
+ * FONT_ROWS rows, from FONT_FIRST on, dark pixels being set. <name> is then
+ * a struct bitmap_font, small enough to be plain C initializers.
+ */
+
+static const char *USAGE = "USAGE: genstaticlogo [-r | -f format [-e big|little] | -i] [-d | -t] static_struct_name outfile.h file1.ppm [ file2.ppm ... ]";
+
+/* rows compared at a time when looking for changes between frames */
+#define DELTA_BAND 8
+/* unchanged columns a rect may span rather than being split in two */
+#define DELTA_GAP 8
+
+/* layout of a font sheet, with -t: the printable ASCII characters and DEL */
+#define FONT_COLUMNS 16
+#define FONT_ROWS 6
+#define FONT_FIRST ' '
+
+static bool rle;
+static bool indexed;
+static bool delta;
+static bool font;
+/* pixel layout to convert to, DS_FB_FORMAT_GENERIC to keep RGB */
+static struct ds_fb fb;
+/* whether the target stores pixel words the other way around, with -e */
+static bool swap;
 
 static inline void write_header(FILE *out)
 {
@@ -41,41 +96,536 @@ static inline void write_header(FILE *out)
           " *\n"                                                \
           " *  Static dietsplash image\n"                        \
           " */\n\n"                                             \
-          "#include \"pnmtologo.h\"\n\n"                        \
+          "#include \"pnmtologo.h\"\n"                          \
+          "#include \"surface.h\"\n\n"                          \
           "#ifndef __DIETSPLASH_STATICLOGO_C\n"                 \
           "#define __DIETSPLASH_STATICLOGO_C\n\n", out);
 }
 
-static inline void write_logo(FILE *out, struct image *logo, int imgidx,
-                              const char *struct_name)
+/* reverse the bytes of each @size bytes word in the @len bytes at @p */
+static void swap_words(char *p, size_t len, int size)
+{
+    size_t i;
+    char c;
+
+    /* 24bpp is stored a byte at a time whatever the host */
+    if (size != 2 && size != 4)
+        return;
+
+    for (i = 0; i + size <= len; i += size) {
+        c = p[i];
+        p[i] = p[i + size - 1];
+        p[i + size - 1] = c;
+        if (size == 4) {
+            c = p[i + 1];
+            p[i + 1] = p[i + 2];
+            p[i + 2] = c;
+        }
+    }
+}
+
+/*
+ * Pixels of the surface ds_surface_new_from_image(), which can't be linked
+ * here, would make, down to the row index given to formats that dither
+ */
+static void write_surface(FILE *fp, const struct image *logo)
+{
+    size_t stride = (size_t) logo->width * (fb.bits_per_pixel / 8);
+    unsigned int j;
+    char *row;
+
+    row = malloc(stride);
+    if (!row)
+        die("Cannot allocate row: %m\n");
+
+    for (j = 0; j < logo->height; j++) {
+        fb.blit_row(&fb, row, logo->pixels + (size_t) j * logo->width,
+                    logo->width, j);
+        if (swap)
+            swap_words(row, stride, fb.bits_per_pixel / 8);
+        fwrite(row, stride, 1, fp);
+    }
+
+    free(row);
+}
+
+/* write the pixels of @logo to @filename, returning its absolute path */
+static char *write_blob(const char *filename, const struct image *logo,
+                        const struct indexed_image *idx)
+{
+    char path[PATH_MAX];
+    FILE *fp;
+    size_t n = (size_t) logo->width * logo->height;
+
+    fp = fopen(filename, "w");
+    if (!fp)
+        die("Cannot create file %s: %m\n", filename);
+
+    if (rle) {
+        if (ds_rle_encode(logo, fp) < 0)
+            die("Cannot write file %s: %m\n", filename);
+    } else if (idx) {
+        /* everything after the fields written by write_logo() */
+        fwrite(idx->palette, sizeof(idx->palette), 1, fp);
+        fwrite(idx->pixels, n, 1, fp);
+    } else if (fb.format != DS_FB_FORMAT_GENERIC) {
+        write_surface(fp, logo);
+    } else if (fwrite(logo->pixels, sizeof(struct color), n, fp) != n) {
+        die("Cannot write file %s: %m\n", filename);
+    }
+
+    if (ferror(fp) || fclose(fp) == EOF)
+        die("Cannot write file %s: %m\n", filename);
+
+    /* the assembler doesn't look for it relative to the header */
+    if (!realpath(filename, path))
+        die("Cannot resolve path of %s: %m\n", filename);
+
+    if (strpbrk(path, "\"\\\n"))
+        die("Can't use %s from assembly, rename it\n", path);
+
+    return strdup(path);
+}
+
+/* hash of what write_logo() puts in .rodata for @logo from @path */
+static uint64_t hash_blob(const char *path, const struct image *logo)
+{
+    uint32_t *buf;
+    FILE *fp;
+    long size;
+    uint64_t hash;
+
+    fp = fopen(path, "r");
+    if (!fp || fseek(fp, 0, SEEK_END) < 0 || (size = ftell(fp)) < 0 ||
+        fseek(fp, 0, SEEK_SET) < 0)
+        die("Cannot read file %s: %m\n", path);
+
+    buf = malloc(2 * sizeof(*buf) + size);
+    if (!buf)
+        die("Out of memory\n");
+
+    buf[0] = logo->width;
+    buf[1] = logo->height;
+    if (fread(buf + 2, 1, size, fp) != (size_t) size)
+        die("Cannot read file %s: %m\n", path);
+    fclose(fp);
+
+    hash = ds_hash(buf, 2 * sizeof(*buf) + size);
+    free(buf);
+
+    return hash;
+}
+
+static inline void write_logo(FILE *out, const struct image *logo, int imgidx,
+                              const char *struct_name, const char *base)
 {
-    long i;
+    char name[256], blob[PATH_MAX];
+    bool surface = fb.format != DS_FB_FORMAT_GENERIC;
+    struct indexed_image *idx = NULL;
+    char *path;
+
+    if (imgidx >= 0) {
+        snprintf(name, sizeof(name), "%s%d", struct_name, imgidx);
+        snprintf(blob, sizeof(blob), "%s-%d.bin", base, imgidx);
+    } else {
+        snprintf(name, sizeof(name), "%s", struct_name);
+        snprintf(blob, sizeof(blob), "%s.bin", base);
+    }
+
+    if (indexed) {
+        idx = ds_image_index(logo);
+        if (!idx && errno == ERANGE)
+            die("Image %s has more than 256 colors\n", name);
+        if (!idx)
+            die("Cannot index image %s: %m\n", name);
+    }
+
+    path = write_blob(blob, logo, idx);
 
-    if (imgidx >= 0)
-        fprintf(out, "static struct image %s%d = {\n", struct_name, imgidx);
+    /* struct ds_surface is aligned as its stride, a long of at most 8 */
+    fprintf(out, "__asm__(\n"
+                 "    \".section .rodata\\n\"\n"
+                 "    \".balign %d\\n\"\n"
+                 "    \".type %s, %%object\\n\"\n"
+                 "    \"%s:\\n\"\n",
+            surface ? 8 : 4, name, name);
+
+    /* same layout as struct image, but with the target's endianness */
+    if (surface)
+        /* and the width of its long, as the compiler of the header sees it */
+        fprintf(out, "    \".int %u, %u\\n\"\n"
+                     "#if __SIZEOF_LONG__ == 8\n"
+                     "    \".quad %u\\n\"\n"
+                     "#else\n"
+                     "    \".int %u\\n\"\n"
+                     "#endif\n"
+                     "    \".int %u\\n\"\n", logo->width, logo->height,
+                logo->width * (fb.bits_per_pixel / 8),
+                logo->width * (fb.bits_per_pixel / 8), fb.bits_per_pixel / 8);
+    else if (indexed)
+        fprintf(out, "    \".int %u, %u, %u\\n\"\n", logo->width,
+                logo->height, idx->colors);
+    else if (!rle && !surface)
+        fprintf(out, "    \".int %u, %u\\n\"\n", logo->width, logo->height);
+
+    fprintf(out, "    \".incbin \\\"%s\\\"\\n\"\n"
+                 "    \".size %s, . - %s\\n\"\n", path, name, name);
+
+    if (rle)
+        fprintf(out, "    \"%s_end:\\n\"\n", name);
+
+    fputs("    \".previous\\n\");\n\n", out);
+
+    if (rle)
+        fprintf(out, "extern const unsigned char %s[], %s_end[];\n\n",
+                name, name);
+    else if (surface)
+        fprintf(out, "extern const struct ds_surface %s;\n\n"
+                     "/* the fields above must be where the compiler puts them */\n"
+                     "typedef char %s_layout[offsetof(struct ds_surface, data) =="
+                     " 3 * sizeof(int) + sizeof(long) ? 1 : -1];\n\n",
+                name, name);
+    else if (indexed)
+        fprintf(out, "extern const struct indexed_image %s;\n\n", name);
     else
-        fprintf(out, "static struct image %s = {\n", struct_name);
+        fprintf(out, "extern const struct image %s;\n\n", name);
 
-    fprintf(out, "    .width = %d,\n", logo->width);
-    fprintf(out, "    .height = %d,\n", logo->height);
+    if (imgidx < 0) {
+        char *c;
 
-    fputs("    .pixels = {\n", out);
-    for (i = 0; i < logo->width * logo->height; i++) {
-        fprintf(out, "        { 0x%02x, 0x%02x, 0x%02x },\n",
-                logo->pixels[i].red,
-                logo->pixels[i].green,
-                logo->pixels[i].blue);
+        for (c = name; *c; c++)
+            *c = toupper((unsigned char) *c);
+        fprintf(out, "#define %s_HASH 0x%016llxULL\n\n", name,
+                (unsigned long long) hash_blob(path, logo));
     }
-    fputs("    }\n};\n\n", out);
+
+    free(idx);
+    free(path);
+}
+
+static inline bool column_differs(const struct image *a, const struct image *b,
+                                  unsigned int x, unsigned int y1,
+                                  unsigned int y2)
+{
+    const struct color *p = a->pixels + (size_t) y1 * a->width + x;
+    const struct color *q = b->pixels + (size_t) y1 * a->width + x;
+    unsigned int y;
+
+    for (y = y1; y < y2; y++, p += a->width, q += a->width)
+        if (memcmp(p, q, sizeof(*p)))
+            return true;
+
+    return false;
+}
+
+static inline bool row_differs(const struct image *a, const struct image *b,
+                               unsigned int x1, unsigned int x2,
+                               unsigned int y)
+{
+    size_t off = (size_t) y * a->width + x1;
+
+    return memcmp(a->pixels + off, b->pixels + off,
+                  (x2 - x1) * sizeof(struct color)) != 0;
+}
+
+/*
+ * Append to the @n @rects those covering what differs from @prev to @cur.
+ * Each band of DELTA_BAND rows is split in spans of changed columns, shrunk
+ * to the rows that actually changed, and spans continuing one from the band
+ * above are merged with it.
+ *
+ * @return the new number of rects
+ */
+static unsigned int diff_frames(const struct image *prev,
+                                const struct image *cur,
+                                struct delta_rect **rects, unsigned int n)
+{
+    unsigned int w = cur->width, h = cur->height, first = n;
+    unsigned int band, x, x1, x2, y1, y2, i;
+
+    for (band = 0; band < h; band += DELTA_BAND) {
+        unsigned int end = MIN(band + DELTA_BAND, h);
+
+        for (x = 0; x < w; ) {
+            while (x < w && !column_differs(prev, cur, x, band, end))
+                x++;
+            if (x == w)
+                break;
+
+            x1 = x;
+            x2 = ++x;
+            for (; x < w && x - x2 <= DELTA_GAP; x++)
+                if (column_differs(prev, cur, x, band, end))
+                    x2 = x + 1;
+            x = x2;
+
+            for (y1 = band; !row_differs(prev, cur, x1, x2, y1); y1++)
+                ;
+            for (y2 = end; !row_differs(prev, cur, x1, x2, y2 - 1); y2--)
+                ;
+
+            for (i = first; i < n; i++) {
+                struct delta_rect *r = &(*rects)[i];
+
+                if (r->x == x1 && r->width == x2 - x1 &&
+                    r->y + r->height == y1)
+                    break;
+            }
+
+            if (i < n) {
+                (*rects)[i].height = y2 - (*rects)[i].y;
+                continue;
+            }
+
+            *rects = realloc(*rects, (n + 1) * sizeof(**rects));
+            if (!*rects)
+                die("Cannot allocate rects: %m\n");
+
+            (*rects)[n].x = x1;
+            (*rects)[n].y = y1;
+            (*rects)[n].width = x2 - x1;
+            (*rects)[n].height = y2 - y1;
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/* tallest first, packing shelves tighter */
+static int compare_height(const void *a, const void *b)
+{
+    const struct delta_rect *ra = *(const struct delta_rect *const *) a;
+    const struct delta_rect *rb = *(const struct delta_rect *const *) b;
+
+    return (int) rb->height - (int) ra->height;
+}
+
+/*
+ * Place the first frame at the top left of the atlas and @rects on shelves
+ * below it, each at the same position modulo 4 as in its frame, so formats
+ * that dither convert them exactly as the whole frame. Fills in their atlas
+ * coordinates and returns the atlas, its unused area in a color already
+ * there so indexing it doesn't take one more.
+ */
+static struct image *pack_atlas(struct image **frames, struct delta_rect *rects,
+                                unsigned int n_rects)
+{
+    struct delta_rect **order;
+    struct image *atlas;
+    unsigned int w = frames[0]->width + 3, h, x, y, shelf, k, j;
+    size_t i, n;
+
+    order = malloc(n_rects * sizeof(*order));
+    if (!order && n_rects)
+        die("Cannot allocate rects: %m\n");
+
+    for (k = 0; k < n_rects; k++)
+        order[k] = &rects[k];
+    qsort(order, n_rects, sizeof(*order), compare_height);
+
+    x = w;
+    y = shelf = frames[0]->height;
+    for (k = 0; k < n_rects; k++) {
+        struct delta_rect *r = order[k];
+
+        if (x + ((r->x - x) & 3) + r->width > w) {
+            y = shelf;
+            x = 0;
+        }
+
+        r->atlas_x = x + ((r->x - x) & 3);
+        r->atlas_y = y + ((r->y - y) & 3);
+        x = r->atlas_x + r->width;
+        shelf = MAX(shelf, (unsigned int) r->atlas_y + r->height);
+    }
+    h = shelf;
+
+    if (h > USHRT_MAX)
+        die("Atlas of %u rows is too large\n", h);
+
+    n = (size_t) w * h;
+    atlas = malloc(sizeof(*atlas) + n * sizeof(struct color));
+    if (!atlas)
+        die("Cannot allocate atlas: %m\n");
+
+    atlas->width = w;
+    atlas->height = h;
+    for (i = 0; i < n; i++)
+        atlas->pixels[i] = frames[0]->pixels[0];
+
+    for (j = 0; j < frames[0]->height; j++)
+        memcpy(atlas->pixels + (size_t) j * w,
+               frames[0]->pixels + (size_t) j * frames[0]->width,
+               frames[0]->width * sizeof(struct color));
+
+    free(order);
+
+    return atlas;
+}
+
+/*
+ * Copy into @atlas the pixels of the @n rects of @frame, placed by
+ * pack_atlas()
+ */
+static void fill_atlas(struct image *atlas, const struct image *frame,
+                       const struct delta_rect *rects, unsigned int n)
+{
+    unsigned int k, j;
+
+    for (k = 0; k < n; k++) {
+        const struct delta_rect *r = &rects[k];
+
+        for (j = 0; j < r->height; j++)
+            memcpy(atlas->pixels + (size_t) (r->atlas_y + j) * atlas->width +
+                   r->atlas_x,
+                   frame->pixels + (size_t) (r->y + j) * frame->width + r->x,
+                   r->width * sizeof(struct color));
+    }
+}
+
+/* frames of an animation, with -d */
+static void write_animation(FILE *out, char *files[], unsigned int n,
+                            const char *struct_name, const char *base)
+{
+    struct image **frames, *atlas;
+    struct delta_frame *deltas;
+    struct delta_rect *rects = NULL;
+    unsigned int i, k, n_rects = 0;
+
+    frames = calloc(n, sizeof(*frames));
+    deltas = calloc(n, sizeof(*deltas));
+    if (!frames || !deltas)
+        die("Cannot allocate frames: %m\n");
+
+    for (i = 0; i < n; i++) {
+        frames[i] = ds_read_image(files[i]);
+        if (!frames[i])
+            die("Cannot read file %s: %m\n", files[i]);
+
+        if (frames[i]->width != frames[0]->width ||
+            frames[i]->height != frames[0]->height)
+            die("Frame %s is not the size of %s\n", files[i], files[0]);
+    }
+
+    if (frames[0]->width > USHRT_MAX - 3 || frames[0]->height > USHRT_MAX)
+        die("Frames of %s are too large\n", struct_name);
+
+    for (i = 0; i < n; i++) {
+        deltas[i].first = n_rects;
+        n_rects = diff_frames(frames[(i + n - 1) % n], frames[i], &rects,
+                              n_rects);
+        deltas[i].n_rects = n_rects - deltas[i].first;
+    }
+
+    atlas = pack_atlas(frames, rects, n_rects);
+    for (i = 0; i < n; i++)
+        fill_atlas(atlas, frames[i], rects + deltas[i].first,
+                   deltas[i].n_rects);
+
+    write_logo(out, atlas, -1, struct_name, base);
+
+    fprintf(out, "static const struct delta_rect %s_first = "
+                 "{ 0, 0, %u, %u, 0, 0 };\n\n", struct_name,
+            frames[0]->width, frames[0]->height);
+
+    fprintf(out, "static const struct delta_rect %s_rects[] = {\n",
+            struct_name);
+    for (k = 0; k < n_rects; k++)
+        fprintf(out, "    { %u, %u, %u, %u, %u, %u },\n", rects[k].x,
+                rects[k].y, rects[k].width, rects[k].height, rects[k].atlas_x,
+                rects[k].atlas_y);
+    /* C has no empty arrays: all frames are the same, nothing reads it */
+    if (!n_rects)
+        fputs("    { 0, 0, 0, 0, 0, 0 },\n", out);
+    fputs("};\n\n", out);
+
+    fprintf(out, "static const struct delta_frame %s_deltas[] = {\n",
+            struct_name);
+    for (i = 0; i < n; i++)
+        fprintf(out, "    { %u, %u },\n", deltas[i].first, deltas[i].n_rects);
+    fputs("};\n\n", out);
+
+    for (i = 0; i < n; i++)
+        free(frames[i]);
+    free(frames);
+    free(deltas);
+    free(rects);
+    free(atlas);
+}
+
+/* font sheet, with -t */
+static void write_font(FILE *out, const char *filename,
+                       const char *struct_name)
+{
+    struct image *sheet;
+    unsigned int c, x, y, width, height, n = 0;
+
+    sheet = ds_read_image(filename);
+    if (!sheet)
+        die("Cannot read file %s: %m\n", filename);
+
+    width = sheet->width / FONT_COLUMNS;
+    height = sheet->height / FONT_ROWS;
+    if (!width || !height || width * FONT_COLUMNS != sheet->width ||
+        height * FONT_ROWS != sheet->height)
+        die("Font %s is not a %ux%u grid of glyphs\n", filename,
+            FONT_COLUMNS, FONT_ROWS);
+
+    fprintf(out, "static const unsigned char %s_bits[] = {", struct_name);
+
+    for (c = 0; c < FONT_COLUMNS * FONT_ROWS; c++) {
+        for (y = 0; y < height; y++) {
+            const struct color *p = sheet->pixels +
+                ((size_t) (c / FONT_COLUMNS * height + y) * sheet->width +
+                 c % FONT_COLUMNS * width);
+            unsigned int bits = 0;
+
+            for (x = 0; x < width; x++, p++) {
+                bits = bits << 1 |
+                       (p->red + p->green + p->blue < 3 * 128);
+
+                if (x % 8 == 7 || x == width - 1) {
+                    bits <<= 7 - x % 8;
+                    fprintf(out, "%s0x%02x,", n++ % 12 ? " " : "\n    ",
+                            bits);
+                    bits = 0;
+                }
+            }
+        }
+    }
+
+    fputs("\n};\n\n", out);
+
+    fprintf(out, "static const struct bitmap_font %s = {\n"
+                 "    %u, %u, %u, %u, %s_bits\n};\n\n", struct_name, width,
+            height, FONT_FIRST, FONT_COLUMNS * FONT_ROWS, struct_name);
+
+    free(sheet);
 }
 
 static inline void write_footer(FILE *out, int n_images,
                                 const char *struct_name)
 {
+    const char *type = fb.format != DS_FB_FORMAT_GENERIC ?
+                       "struct ds_surface" : indexed ?
+                       "struct indexed_image" : "struct image";
     int i;
 
-    if (n_images > 1) {
-        fprintf(out, "static struct image *%s[] = {\n", struct_name);
+    if (n_images > 1 && rle) {
+        fprintf(out, "static const unsigned char *const %s[] = {\n",
+                struct_name);
+        for (i = 0; i < n_images; i++)
+            fprintf(out, "    %s%d,\n", struct_name, i);
+        fputs("};\n\n", out);
+
+        fprintf(out, "static const unsigned char *const %s_end[] = {\n",
+                struct_name);
+        for (i = 0; i < n_images; i++)
+            fprintf(out, "    %s%d_end,\n", struct_name, i);
+        fputs("};\n\n", out);
+    } else if (n_images > 1) {
+        fprintf(out, "static const %s *const %s[] = {\n", type, struct_name);
         for (i = 0; i < n_images; i++)
             fprintf(out, "    &%s%d,\n", struct_name, i);
 
@@ -91,8 +641,44 @@ int main(int argc, char *argv[])
     int i, multiple_files = 0;
     const char *static_struct_name;
     static FILE *fp_out;
+    char base[PATH_MAX];
+
+    for (; argc > 1 && argv[1][0] == '-'; argc--, argv++) {
+        if (!strcmp(argv[1], "-r")) {
+            rle = true;
+        } else if (!strcmp(argv[1], "-i")) {
+            indexed = true;
+        } else if (!strcmp(argv[1], "-d")) {
+            delta = true;
+        } else if (!strcmp(argv[1], "-t")) {
+            font = true;
+        } else if (argc > 2 && !strcmp(argv[1], "-f")) {
+            if (ds_blit_format_fill(&fb, ds_blit_format_from_name(argv[2])) < 0)
+                die("Unknown framebuffer format %s\n", argv[2]);
+
+            fb.blit_row = ds_blit_row_func_get(&fb);
+            argc--;
+            argv++;
+        } else if (argc > 2 && !strcmp(argv[1], "-e")) {
+            bool big = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+
+            if (!strcmp(argv[2], "big"))
+                swap = !big;
+            else if (!strcmp(argv[2], "little"))
+                swap = big;
+            else
+                die("%s", USAGE);
+            argc--;
+            argv++;
+        } else {
+            die("%s", USAGE);
+        }
+    }
 
-    if (argc < 4)
+    if (argc < 4 || rle + indexed + (fb.format != DS_FB_FORMAT_GENERIC) > 1 ||
+        (delta && (rle || fb.format != DS_FB_FORMAT_GENERIC)) ||
+        (font && (argc != 4 || rle || indexed || delta ||
+                  fb.format != DS_FB_FORMAT_GENERIC)))
         die("%s", USAGE);
 
     if (argc > 4)
@@ -106,18 +692,37 @@ int main(int argc, char *argv[])
 	fp_out = fopen(filename_out, "w");
 	if (!fp_out)
 	    die("Cannot create file %s: %m\n", filename_out);
+	snprintf(base, sizeof(base), "%s", filename_out);
+	if (strlen(base) > 2 && !strcmp(base + strlen(base) - 2, ".h"))
+	    base[strlen(base) - 2] = '\0';
     } else {
 	fp_out = stdout;
+	snprintf(base, sizeof(base), "%s", static_struct_name);
     }
 
     write_header(fp_out);
 
+    if (font) {
+        write_font(fp_out, argv[3], static_struct_name);
+        fputs("#endif", fp_out);
+        fclose(fp_out);
+        return 0;
+    }
+
+    if (delta) {
+        write_animation(fp_out, argv + 3, argc - 3, static_struct_name, base);
+        fputs("#endif", fp_out);
+        fclose(fp_out);
+        return 0;
+    }
+
     for (i = 3; i < argc; i++) {
         struct image *logo = ds_read_image(argv[i]);
         if (!logo)
-            die("Cannot read file %s\n", argv[i]);
+            die("Cannot read file %s: %m\n", argv[i]);
 
-        write_logo(fp_out, logo, i - 4 + multiple_files, static_struct_name);
+        write_logo(fp_out, logo, i - 4 + multiple_files, static_struct_name,
+                   base);
         free(logo);
     }
 
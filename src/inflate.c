@@ -0,0 +1,459 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * inflate.c - decompression of zlib streams
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+/*
+ * Deflate as described in RFC 1951, wrapped as in RFC 1950. Only what's
+ * needed to read images we ship: the checksum is not verified, a corrupt
+ * stream is caught by the decoding itself or shows on screen.
+ */
+
+#include "inflate.h"
+#include "util.h"
+
+#include <errno.h>
+#include <string.h>
+
+#define WINDOW_MASK (DS_INFLATE_WINDOW - 1)
+
+enum {
+    STATE_HEADER = 0,
+    STATE_STORED,
+    STATE_HUFFMAN,
+    STATE_DONE,
+};
+
+static const uint16_t _length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+
+static const uint8_t _length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+
+static const uint16_t _dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577,
+};
+
+static const uint8_t _dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+/*
+ * Past the end of data the buffer is filled with zeros, so decoding never
+ * has to check. Using any of them is an error, caught by the caller.
+ */
+static inline void _inflate_refill(struct ds_inflate *inf)
+{
+    while (inf->nbits <= 56) {
+        if (inf->p < inf->end)
+            inf->bits |= (uint64_t) *inf->p++ << inf->nbits;
+        else
+            inf->overrun += 8;
+        inf->nbits += 8;
+    }
+}
+
+static inline unsigned int _inflate_bits(struct ds_inflate *inf, int n)
+{
+    unsigned int v;
+
+    if (inf->nbits < n)
+        _inflate_refill(inf);
+
+    v = inf->bits & ((1u << n) - 1);
+    inf->bits >>= n;
+    inf->nbits -= n;
+
+    return v;
+}
+
+static int _huffman_build(struct ds_huffman *h, const unsigned char *lengths,
+                          int n)
+{
+    uint16_t offs[16];
+    unsigned int code, rev, k;
+    int len, sym, left, i, idx;
+
+    memset(h->count, 0, sizeof(h->count));
+    memset(h->fast, 0, sizeof(h->fast));
+
+    for (sym = 0; sym < n; sym++)
+        h->count[lengths[sym]]++;
+    h->count[0] = 0;
+
+    /* incomplete codes are fine, unused codes fail when decoded */
+    for (len = 1, left = 1; len < 16; len++) {
+        left = (left << 1) - h->count[len];
+        if (left < 0)
+            return -EINVAL;
+    }
+
+    for (len = 1, offs[1] = 0; len < 15; len++)
+        offs[len + 1] = offs[len] + h->count[len];
+
+    for (sym = 0; sym < n; sym++)
+        if (lengths[sym])
+            h->symbol[offs[lengths[sym]]++] = sym;
+
+    /* codes are assigned in order of length, then symbol */
+    for (len = 1, code = 0, idx = 0; len <= DS_INFLATE_FAST_BITS; len++) {
+        for (i = 0; i < h->count[len]; i++, code++, idx++) {
+            for (k = 0, rev = 0; k < (unsigned int) len; k++)
+                rev |= ((code >> k) & 1) << (len - 1 - k);
+
+            for (k = rev; k < (1u << DS_INFLATE_FAST_BITS); k += 1u << len)
+                h->fast[k] = h->symbol[idx] << 4 | len;
+        }
+        code <<= 1;
+    }
+
+    return 0;
+}
+
+static int _huffman_decode(struct ds_inflate *inf, const struct ds_huffman *h)
+{
+    unsigned int e, code, first, index, count;
+    int len;
+
+    if (inf->nbits < 15)
+        _inflate_refill(inf);
+
+    e = h->fast[inf->bits & ((1u << DS_INFLATE_FAST_BITS) - 1)];
+    if (e) {
+        inf->bits >>= e & 15;
+        inf->nbits -= e & 15;
+        return e >> 4;
+    }
+
+    /* long codes, one bit at a time */
+    for (len = 1, code = first = index = 0; len < 16; len++) {
+        code |= inf->bits & 1;
+        inf->bits >>= 1;
+        inf->nbits--;
+
+        count = h->count[len];
+        if (code < first + count)
+            return h->symbol[index + code - first];
+
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+
+    return -EINVAL;
+}
+
+static int _inflate_fixed(struct ds_inflate *inf)
+{
+    unsigned char lengths[288 + 30];
+    int i;
+
+    for (i = 0; i < 144; i++)
+        lengths[i] = 8;
+    for (; i < 256; i++)
+        lengths[i] = 9;
+    for (; i < 280; i++)
+        lengths[i] = 7;
+    for (; i < 288 + 30; i++)
+        lengths[i] = i < 288 ? 8 : 5;
+
+    if (_huffman_build(&inf->lit, lengths, 288) < 0 ||
+        _huffman_build(&inf->dist, lengths + 288, 30) < 0)
+        return -EINVAL;
+
+    return 0;
+}
+
+static int _inflate_dynamic(struct ds_inflate *inf)
+{
+    static const uint8_t order[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+    };
+    unsigned char lengths[286 + 30];
+    int nlit, ndist, nlen, i, sym, rep;
+    unsigned char val;
+
+    nlit = _inflate_bits(inf, 5) + 257;
+    ndist = _inflate_bits(inf, 5) + 1;
+    nlen = _inflate_bits(inf, 4) + 4;
+    if (nlit > 286 || ndist > 30)
+        return -EINVAL;
+
+    memset(lengths, 0, sizeof(lengths));
+    for (i = 0; i < nlen; i++)
+        lengths[order[i]] = _inflate_bits(inf, 3);
+
+    /* the code for code lengths is only needed here, borrow lit */
+    if (_huffman_build(&inf->lit, lengths, 19) < 0)
+        return -EINVAL;
+
+    for (i = 0; i < nlit + ndist;) {
+        sym = _huffman_decode(inf, &inf->lit);
+        if (sym < 0)
+            return -EINVAL;
+
+        if (sym < 16) {
+            lengths[i++] = sym;
+            continue;
+        }
+
+        if (sym == 16) {
+            if (!i)
+                return -EINVAL;
+            val = lengths[i - 1];
+            rep = 3 + _inflate_bits(inf, 2);
+        } else if (sym == 17) {
+            val = 0;
+            rep = 3 + _inflate_bits(inf, 3);
+        } else {
+            val = 0;
+            rep = 11 + _inflate_bits(inf, 7);
+        }
+
+        if (i + rep > nlit + ndist)
+            return -EINVAL;
+
+        memset(lengths + i, val, rep);
+        i += rep;
+    }
+
+    /* without an end of block code the block would never end */
+    if (!lengths[256])
+        return -EINVAL;
+
+    if (_huffman_build(&inf->lit, lengths, nlit) < 0 ||
+        _huffman_build(&inf->dist, lengths + nlit, ndist) < 0)
+        return -EINVAL;
+
+    return 0;
+}
+
+static int _inflate_block(struct ds_inflate *inf)
+{
+    unsigned int len, nlen;
+
+    if (inf->last) {
+        inf->state = STATE_DONE;
+        return -EINVAL;
+    }
+
+    inf->last = _inflate_bits(inf, 1);
+
+    switch (_inflate_bits(inf, 2)) {
+    case 0:
+        /* stored blocks start at a byte boundary */
+        _inflate_bits(inf, inf->nbits & 7);
+        len = _inflate_bits(inf, 16);
+        nlen = _inflate_bits(inf, 16);
+        if (len != (~nlen & 0xffff))
+            return -EINVAL;
+        inf->stored = len;
+        inf->state = STATE_STORED;
+        return 0;
+    case 1:
+        inf->state = STATE_HUFFMAN;
+        return _inflate_fixed(inf);
+    case 2:
+        inf->state = STATE_HUFFMAN;
+        return _inflate_dynamic(inf);
+    default:
+        return -EINVAL;
+    }
+}
+
+static inline void _inflate_put(struct ds_inflate *inf, unsigned char *out,
+                                unsigned char c)
+{
+    *out = c;
+    inf->window[inf->total++ & WINDOW_MASK] = c;
+}
+
+/*
+ * Copy what fits in @n bytes of the pending match to @out. Most of the
+ * output of splash images comes from matches, so they are copied in blocks
+ * rather than byte by byte: a block can't cross the end of the window and,
+ * when the match overlaps itself, can't be longer than what's already
+ * written of it.
+ *
+ * @return number of bytes copied
+ */
+static size_t _inflate_copy(struct ds_inflate *inf, unsigned char *out,
+                            size_t n)
+{
+    unsigned char *w = inf->window;
+    size_t src, dst, k, c, done;
+
+    n = MIN(n, inf->match_len);
+
+    for (done = 0; done < n; done += k) {
+        src = (inf->total - inf->match_dist) & WINDOW_MASK;
+        dst = inf->total & WINDOW_MASK;
+        k = MIN(n - done, DS_INFLATE_WINDOW - MAX(src, dst));
+
+        if (src > dst || inf->match_dist >= k) {
+            memmove(w + dst, w + src, k);
+        } else {
+            for (c = 0; c < k; c += MIN(k - c, dst + c - src))
+                memcpy(w + dst + c, w + src, MIN(k - c, dst + c - src));
+        }
+
+        memcpy(out + done, w + dst, k);
+        inf->total += k;
+    }
+
+    inf->match_len -= n;
+
+    return n;
+}
+
+/*
+ * Decode symbols of a Huffman block into @out until @n bytes are there or
+ * the block ends
+ *
+ * @return number of bytes written or a negative errno
+ */
+static long _inflate_huffman(struct ds_inflate *inf, unsigned char *out,
+                             size_t n)
+{
+    size_t i = 0;
+    unsigned int len, dist;
+    int sym;
+
+    while (i < n) {
+        sym = _huffman_decode(inf, &inf->lit);
+        if (sym < 0)
+            return sym;
+
+        if (sym < 256) {
+            _inflate_put(inf, out + i++, sym);
+            continue;
+        }
+
+        if (sym == 256) {
+            inf->state = STATE_HEADER;
+            break;
+        }
+
+        sym -= 257;
+        if (sym >= 29)
+            return -EINVAL;
+        len = _length_base[sym] + _inflate_bits(inf, _length_extra[sym]);
+
+        sym = _huffman_decode(inf, &inf->dist);
+        if (sym < 0 || sym >= 30)
+            return -EINVAL;
+        dist = _dist_base[sym] + _inflate_bits(inf, _dist_extra[sym]);
+
+        if (dist > inf->total)
+            return -EINVAL;
+
+        /* what doesn't fit goes to the next call */
+        inf->match_len = len;
+        inf->match_dist = dist;
+        i += _inflate_copy(inf, out + i, n - i);
+    }
+
+    return i;
+}
+
+/**
+ * Start decompressing the zlib stream held in the @size bytes at @data,
+ * which must stay around while it's read
+ *
+ * @return 0 on success or -EINVAL if it doesn't start as one
+ */
+int ds_inflate_init(struct ds_inflate *inf, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+
+    /* deflate, window up to 32K, no preset dictionary */
+    if (size < 2 || (p[0] & 0x0f) != 8 || (p[0] >> 4) > 7 ||
+        (p[1] & 0x20) || (p[0] << 8 | p[1]) % 31)
+        return -EINVAL;
+
+    inf->p = p + 2;
+    inf->end = p + size;
+    inf->bits = 0;
+    inf->nbits = 0;
+    inf->overrun = 0;
+    inf->state = STATE_HEADER;
+    inf->last = 0;
+    inf->stored = 0;
+    inf->match_len = 0;
+    inf->total = 0;
+
+    return 0;
+}
+
+/**
+ * Decompress the next @n bytes into @out
+ *
+ * @return 0 on success or -EINVAL if the stream is corrupt or ends before
+ */
+int ds_inflate_read(struct ds_inflate *inf, unsigned char *out, size_t n)
+{
+    size_t i = 0;
+    long ret;
+
+    while (i < n) {
+        if (inf->match_len) {
+            i += _inflate_copy(inf, out + i, n - i);
+            continue;
+        }
+
+        switch (inf->state) {
+        case STATE_HEADER:
+            ret = _inflate_block(inf);
+            break;
+        case STATE_STORED:
+            if (!inf->stored) {
+                inf->state = STATE_HEADER;
+                continue;
+            }
+            _inflate_put(inf, out + i++, _inflate_bits(inf, 8));
+            inf->stored--;
+            ret = 0;
+            break;
+        case STATE_HUFFMAN:
+            ret = _inflate_huffman(inf, out + i, n - i);
+            if (ret > 0)
+                i += ret;
+            break;
+        default:
+            ret = -EINVAL;
+            break;
+        }
+
+        if (ret < 0 || inf->overrun > inf->nbits)
+            return -EINVAL;
+    }
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * inflate.h - decompression of zlib streams
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#ifndef __DIETSPLASH_INFLATE_H
+#define __DIETSPLASH_INFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DS_INFLATE_WINDOW (1 << 15)
+#define DS_INFLATE_FAST_BITS 10
+
+/*
+ * Canonical Huffman code. Codes up to DS_INFLATE_FAST_BITS long are
+ * decoded with a single lookup in @fast, holding symbol << 4 | length, or
+ * 0 for longer codes.
+ */
+struct ds_huffman {
+    uint16_t fast[1 << DS_INFLATE_FAST_BITS];
+    uint16_t count[16];
+    uint16_t symbol[288];
+};
+
+/*
+ * The whole compressed stream must be in memory. Decoding stops whenever
+ * the caller has got as many bytes as asked for, and continues from there
+ * on the next call.
+ */
+struct ds_inflate {
+    const unsigned char *p;
+    const unsigned char *end;
+    uint64_t bits;
+    int nbits;
+    int overrun;
+    int state;
+    int last;
+    unsigned long stored;
+    unsigned int match_len;
+    unsigned int match_dist;
+    unsigned long total;
+    struct ds_huffman lit;
+    struct ds_huffman dist;
+    unsigned char window[DS_INFLATE_WINDOW];
+};
+
+int ds_inflate_init(struct ds_inflate *inf, const void *data, size_t size);
+int ds_inflate_read(struct ds_inflate *inf, unsigned char *out, size_t n);
+
+#endif
@@ -23,9 +23,12 @@
  *
  */
 
+#include "animation.h"
 #include "events.h"
 #include "fb.h"
+#include "progress.h"
 #include "log.h"
+#include "status.h"
 #include "util.h"
 
 #include <stdbool.h>
@@ -72,7 +75,25 @@ int main(int argc, char *argv[])
     if (ds_events_init() == -1)
         goto err_on_events;
 
+    if (ds_fb_watch(&ds_info.fb) == -1)
+        goto err_on_watch;
+
     ds_events_timer_add(TIMERS_QUIT, MAX_RUNTIME, 0, true);
+
+#ifdef ENABLE_PROGRESS
+    ds_progress_start(&ds_info.fb);
+#endif
+
+#ifdef ENABLE_STATUS
+    if (ds_status_start(&ds_info.fb) < 0)
+        wrn("status messages won't be shown");
+#endif
+
+#ifdef ENABLE_ANIMATION
+    if (ds_animation_start(&ds_info.fb) < 0)
+        wrn("animation not started, showing the background only");
+#endif
+
     ds_events_run();
 
     /*
@@ -83,12 +104,21 @@ int main(int argc, char *argv[])
                 ds_events_status_get() == MAINLOOP_STATUS_EXIT_FAILURE)
         ds_console_restore();
 
+#ifdef ENABLE_ANIMATION
+    ds_animation_stop();
+#endif
+#ifdef ENABLE_STATUS
+    ds_status_stop();
+#endif
     ds_events_shutdown();
     ds_fb_shutdown(&ds_info.fb);
     ds_log_shutdown();
 
     return 0;
 
+err_on_watch:
+    ds_events_shutdown();
+
 err_on_events:
     ds_fb_shutdown(&ds_info.fb);
 
@@ -0,0 +1,439 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * png.c - decoding of PNG images
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "png.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Chunks are walked in place. CRCs are not checked, as the checksum of the
+ * compressed data isn't: images are ours, not something from the network.
+ */
+struct png_chunk {
+    const unsigned char *type;
+    const unsigned char *data;
+    uint32_t len;
+};
+
+static inline uint32_t _be32(const unsigned char *p)
+{
+    return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static int _png_next_chunk(const unsigned char **p, const unsigned char *end,
+                           struct png_chunk *chunk)
+{
+    if (end - *p < 12)
+        return -EINVAL;
+
+    chunk->len = _be32(*p);
+    if (chunk->len > (size_t)(end - *p) - 12)
+        return -EINVAL;
+
+    chunk->type = *p + 4;
+    chunk->data = *p + 8;
+    *p = chunk->data + chunk->len + 4;
+
+    return 0;
+}
+
+static inline bool _png_chunk_is(const struct png_chunk *chunk,
+                                 const char *type)
+{
+    return !memcmp(chunk->type, type, 4);
+}
+
+static inline unsigned char _png_blend(unsigned int c, unsigned int alpha,
+                                       unsigned int bg)
+{
+    return (c * alpha + bg * (255 - alpha) + 127) / 255;
+}
+
+static int _png_header(struct ds_png *png, const struct png_chunk *chunk)
+{
+    const unsigned char *p = chunk->data;
+    unsigned int depths;
+
+    if (chunk->len != 13)
+        return -EINVAL;
+
+    png->width = _be32(p);
+    png->height = _be32(p + 4);
+    png->depth = p[8];
+    png->color_type = p[9];
+
+    /* larger sizes are allowed by PNG, but make the row sizes wrap */
+    if (!png->width || !png->height || png->width > DS_IMAGE_MAX_SIZE ||
+        png->height > DS_IMAGE_MAX_SIZE || p[10] || p[11])
+        return -EINVAL;
+
+    /* as bit masks of the depths allowed */
+    switch (png->color_type) {
+    case 0:
+        png->channels = 1;
+        depths = 1 | 2 | 4 | 8 | 16;
+        break;
+    case 2:
+        png->channels = 3;
+        depths = 8 | 16;
+        break;
+    case 3:
+        png->channels = 1;
+        depths = 1 | 2 | 4 | 8;
+        break;
+    case 4:
+        png->channels = 2;
+        depths = 8 | 16;
+        break;
+    case 6:
+        png->channels = 4;
+        depths = 8 | 16;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    if (png->depth & (png->depth - 1) || !(png->depth & depths))
+        return -EINVAL;
+
+    /* Adam7 would need the whole image before showing any row */
+    if (p[12])
+        return p[12] == 1 ? -ENOTSUP : -EINVAL;
+
+    png->stride = ((size_t) png->width * png->channels * png->depth + 7) / 8;
+    png->bpp = MAX(png->channels * png->depth / 8, 1);
+
+    return 0;
+}
+
+static int _png_palette(struct ds_png *png, const struct png_chunk *chunk)
+{
+    const unsigned char *p = chunk->data;
+    unsigned int i;
+
+    if (chunk->len % 3 || chunk->len / 3 > ARRAY_SIZE(png->palette))
+        return -EINVAL;
+
+    for (i = 0; i < chunk->len / 3; i++, p += 3) {
+        png->palette[i].red = p[0];
+        png->palette[i].green = p[1];
+        png->palette[i].blue = p[2];
+    }
+
+    return 0;
+}
+
+/* only the alpha of palette entries is honored, as it costs nothing */
+static void _png_palette_alpha(struct ds_png *png,
+                               const struct png_chunk *chunk)
+{
+    unsigned int i, n = MIN(chunk->len, ARRAY_SIZE(png->palette));
+
+    for (i = 0; i < n; i++) {
+        struct color *c = &png->palette[i];
+
+        c->red = _png_blend(c->red, chunk->data[i],
+                            (BACKGROUND_COLOR >> 16) & 0xff);
+        c->green = _png_blend(c->green, chunk->data[i],
+                              (BACKGROUND_COLOR >> 8) & 0xff);
+        c->blue = _png_blend(c->blue, chunk->data[i],
+                             BACKGROUND_COLOR & 0xff);
+    }
+}
+
+/**
+ * Start reading the PNG image in @data, which must stay around while rows
+ * are read
+ *
+ * @return 0 on success, -EINVAL if @data is not a PNG image, -ENOTSUP if it's
+ * interlaced or -ENOMEM
+ */
+int ds_png_init(struct ds_png *png, const void *data, size_t size)
+{
+    const unsigned char *p = data, *end = p + size, *idat = NULL;
+    const unsigned char *first_idat = NULL;
+    struct png_chunk chunk, trns = { .len = 0 };
+    size_t idat_size = 0;
+    unsigned int n_idat = 0;
+    bool palette = false;
+    unsigned char *q;
+    int ret;
+
+    png->idat = NULL;
+    png->rows = NULL;
+    png->row = 0;
+    memset(png->palette, 0, sizeof(png->palette));
+
+    if (size < DS_PNG_MAGIC_SIZE || memcmp(p, DS_PNG_MAGIC, DS_PNG_MAGIC_SIZE))
+        return -EINVAL;
+    p += DS_PNG_MAGIC_SIZE;
+
+    ret = _png_next_chunk(&p, end, &chunk);
+    if (ret < 0 || !_png_chunk_is(&chunk, "IHDR"))
+        return -EINVAL;
+
+    ret = _png_header(png, &chunk);
+    if (ret < 0)
+        return ret;
+
+    for (;;) {
+        const unsigned char *start = p;
+
+        ret = _png_next_chunk(&p, end, &chunk);
+        if (ret < 0)
+            return ret;
+
+        if (_png_chunk_is(&chunk, "IEND"))
+            break;
+
+        if (_png_chunk_is(&chunk, "IDAT")) {
+            if (!n_idat++) {
+                first_idat = start;
+                idat = chunk.data;
+            }
+            idat_size += chunk.len;
+        } else if (_png_chunk_is(&chunk, "PLTE")) {
+            ret = _png_palette(png, &chunk);
+            if (ret < 0)
+                return ret;
+            palette = true;
+        } else if (_png_chunk_is(&chunk, "tRNS")) {
+            trns = chunk;
+        }
+    }
+
+    if (!n_idat || (png->color_type == 3 && !palette))
+        return -EINVAL;
+
+    if (png->color_type == 3 && trns.len)
+        _png_palette_alpha(png, &trns);
+
+    /* the compressed stream may be split in any number of chunks */
+    if (n_idat > 1) {
+        png->idat = q = malloc(idat_size);
+        if (!png->idat)
+            return -ENOMEM;
+
+        for (p = first_idat; n_idat; ) {
+            _png_next_chunk(&p, end, &chunk);
+            if (_png_chunk_is(&chunk, "IDAT")) {
+                memcpy(q, chunk.data, chunk.len);
+                q += chunk.len;
+                n_idat--;
+            }
+        }
+
+        idat = png->idat;
+    }
+
+    /* the row above the first one is taken as zeros by filters */
+    png->rows = calloc(2, png->stride + 1);
+    if (!png->rows) {
+        ret = -ENOMEM;
+        goto release;
+    }
+
+    ret = ds_inflate_init(&png->inflate, idat, idat_size);
+    if (ret < 0)
+        goto release;
+
+    return 0;
+
+release:
+    ds_png_release(png);
+    return ret;
+}
+
+static inline unsigned char _png_paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc)
+        return a;
+
+    return pb <= pc ? b : c;
+}
+
+/*
+ * Up is what encoders pick for most rows of a splash image. Bytes are
+ * summed 8 at a time, keeping carries from crossing into the next byte.
+ */
+static void _png_add_row(unsigned char *cur, const unsigned char *prev,
+                         size_t n)
+{
+    const uint64_t high = 0x8080808080808080ULL;
+    uint64_t a, b;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        memcpy(&a, cur + i, 8);
+        memcpy(&b, prev + i, 8);
+        a = ((a & ~high) + (b & ~high)) ^ ((a ^ b) & high);
+        memcpy(cur + i, &a, 8);
+    }
+
+    for (; i < n; i++)
+        cur[i] += prev[i];
+}
+
+/*
+ * Undo the filter of @cur, whose first byte says which one it is. Bytes to
+ * the left of the row are taken as zeros.
+ */
+static int _png_unfilter(const struct ds_png *png, unsigned char *cur,
+                         const unsigned char *prev)
+{
+    size_t i, n = png->stride, bpp = png->bpp;
+    int type = *cur++;
+
+    prev++;
+
+    switch (type) {
+    case 0:
+        break;
+    case 1:
+        for (i = bpp; i < n; i++)
+            cur[i] += cur[i - bpp];
+        break;
+    case 2:
+        _png_add_row(cur, prev, n);
+        break;
+    case 3:
+        for (i = 0; i < bpp; i++)
+            cur[i] += prev[i] >> 1;
+        for (; i < n; i++)
+            cur[i] += (cur[i - bpp] + prev[i]) >> 1;
+        break;
+    case 4:
+        for (i = 0; i < bpp; i++)
+            cur[i] += prev[i];
+        for (; i < n; i++)
+            cur[i] += _png_paeth(cur[i - bpp], prev[i], prev[i - bpp]);
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static void _png_convert_row(const struct ds_png *png, const unsigned char *s,
+                             struct color *dst)
+{
+    unsigned int x, bit, v, mask, alpha, w = png->width;
+    int bytes = png->depth == 16 ? 2 : 1;
+    int step = png->channels * bytes;
+
+    /* samples packed in bytes, leftmost in the high bits */
+    if (png->depth < 8) {
+        mask = (1u << png->depth) - 1;
+        for (x = 0, bit = 0; x < w; x++, bit += png->depth) {
+            v = s[bit >> 3] >> (8 - png->depth - (bit & 7)) & mask;
+            if (png->color_type == 3)
+                dst[x] = png->palette[v];
+            else
+                dst[x].red = dst[x].green = dst[x].blue = v * 255 / mask;
+        }
+        return;
+    }
+
+    if (png->color_type == 3) {
+        for (x = 0; x < w; x++)
+            dst[x] = png->palette[s[x]];
+        return;
+    }
+
+    /* already laid out as our pixels */
+    if (png->color_type == 2 && bytes == 1) {
+        memcpy(dst, s, w * sizeof(struct color));
+        return;
+    }
+
+    /* of 16 bit samples, the most significant byte is enough */
+    for (x = 0; x < w; x++, s += step) {
+        dst[x].red = s[0];
+        if (png->channels >= 3) {
+            dst[x].green = s[bytes];
+            dst[x].blue = s[2 * bytes];
+        } else {
+            dst[x].green = dst[x].blue = s[0];
+        }
+
+        if (png->channels & 1)
+            continue;
+
+        alpha = s[step - bytes];
+        dst[x].red = _png_blend(dst[x].red, alpha,
+                                (BACKGROUND_COLOR >> 16) & 0xff);
+        dst[x].green = _png_blend(dst[x].green, alpha,
+                                  (BACKGROUND_COLOR >> 8) & 0xff);
+        dst[x].blue = _png_blend(dst[x].blue, alpha, BACKGROUND_COLOR & 0xff);
+    }
+}
+
+/**
+ * Decode the next @rows rows of @png into @pixels, which must have room for
+ * @rows times its width
+ *
+ * @return 0 on success or -EINVAL if the image is corrupt or truncated
+ */
+int ds_png_read(struct ds_png *png, struct color *pixels, unsigned int rows)
+{
+    size_t len = png->stride + 1;
+    unsigned char *cur, *prev;
+    unsigned int y;
+    int ret;
+
+    for (y = 0; y < rows; y++, pixels += png->width, png->row++) {
+        cur = png->rows + (png->row & 1) * len;
+        prev = png->rows + (~png->row & 1) * len;
+
+        ret = ds_inflate_read(&png->inflate, cur, len);
+        if (ret < 0)
+            return ret;
+
+        ret = _png_unfilter(png, cur, prev);
+        if (ret < 0)
+            return ret;
+
+        _png_convert_row(png, cur + 1, pixels);
+    }
+
+    return 0;
+}
+
+void ds_png_release(struct ds_png *png)
+{
+    free(png->idat);
+    free(png->rows);
+    png->idat = NULL;
+    png->rows = NULL;
+}
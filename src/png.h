@@ -0,0 +1,60 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * png.h - decoding of PNG images
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#ifndef __DIETSPLASH_PNG_H
+#define __DIETSPLASH_PNG_H
+
+#include <stddef.h>
+
+#include "inflate.h"
+#include "pnmtologo.h"
+
+#define DS_PNG_MAGIC "\x89PNG\r\n\x1a\n"
+#define DS_PNG_MAGIC_SIZE 8
+
+/*
+ * Non-interlaced PNG of any color type and bit depth, decoded a number of
+ * rows at a time. Transparent pixels are blended over BACKGROUND_COLOR.
+ */
+struct ds_png {
+    unsigned int width;
+    unsigned int height;
+    int color_type;
+    int depth;
+    int channels;
+    size_t stride;              /* bytes of a row, without the filter type */
+    size_t bpp;                 /* bytes of a pixel, at least 1 */
+    struct color palette[256];
+    unsigned char *idat;        /* IDAT chunks joined, when there are many */
+    unsigned char *rows;        /* last two rows, each after its filter type */
+    unsigned int row;
+    struct ds_inflate inflate;
+};
+
+int ds_png_init(struct ds_png *png, const void *data, size_t size);
+int ds_png_read(struct ds_png *png, struct color *pixels, unsigned int rows);
+void ds_png_release(struct ds_png *png);
+
+#endif
@@ -26,198 +26,885 @@
  *
  */
 
+#include "png.h"
 #include "pnmtologo.h"
+#include "rle.h"
 
-#include <ctype.h>
-#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(ENABLE_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "util.h"
 
-static unsigned int get_number(FILE *fp)
+/*
+ * The whole file is mapped and parsed from memory. Anything up to ' ' is
+ * taken as a separator, which covers the whitespace PNM allows.
+ *
+ * Pixels are decoded a number of rows at a time, each read starting where
+ * the last one stopped, so callers can draw an image without ever holding
+ * all of it.
+ */
+struct ds_image_stream {
+    const unsigned char *p;
+    const unsigned char *end;
+    void *map;
+    size_t map_size;
+    unsigned int width;
+    unsigned int height;
+    unsigned int row;
+    int magic;                  /* '1'-'6' PNM, 'R' RLE, 'N' PNG */
+    int channels;
+    unsigned int maxval;
+    unsigned char *table;
+    struct ds_rle rle;
+    struct ds_rle_packet packet;    /* what's left of the last one */
+    struct ds_png png;
+};
+
+/*
+ * Parse the next decimal number of the header into @val. Sizes and maxval
+ * alike can't be above DS_IMAGE_MAX_SIZE, which is also the largest maxval
+ * PNM allows.
+ *
+ * @return the position after it, or NULL if there is none before the end
+ * of file, something else is found or it's too large
+ */
+static const unsigned char *get_number(const unsigned char *s,
+                                       const unsigned char *end, long *val)
 {
-    int c, val;
+    unsigned int d;
+    long v;
+
+    for (;; s++) {
+        if (s == end)
+            return NULL;
+        if (*s == '#')
+            /* Ignore comments 'till end of line */
+            while (s + 1 < end && s[1] != '\n')
+                s++;
+        else if (*s > ' ')
+            break;
+    }
 
-    /* Skip leading whitespace */
-    do {
-	c = fgetc(fp);
-	if (c == EOF)
-	    die("end of file\n");
-	if (c == '#') {
-	    /* Ignore comments 'till end of line */
-	    do {
-		c = fgetc(fp);
-		if (c == EOF)
-		    die("end of file\n");
-	    } while (c != '\n');
-	}
-    } while (isspace(c));
+    if ((d = *s - '0') > 9)
+        return NULL;
 
-    /* Parse decimal number */
-    val = 0;
-    while (isdigit(c)) {
-	val = 10 * val + c - '0';
-	c = fgetc(fp);
-	if (c == EOF)
-	    die("end of file\n");
+    for (v = d, s++; s < end && (d = *s - '0') <= 9; s++) {
+        v = 10 * v + d;
+        if (v > DS_IMAGE_MAX_SIZE)
+            return NULL;
     }
-    return val;
+
+    *val = v;
+
+    return s;
 }
 
-static unsigned int get_number255(FILE *fp, unsigned int maxval)
+/*
+ * Samples are 1 byte up to maxval 255 and 2 bytes, big endian, above that.
+ * Rescaling any of them to 0..255 is a lookup in a table indexed by the raw
+ * sample. Plain ones are any number of up to PLAIN_MAX_DIGITS digits, so
+ * their table covers all of those, the ones past maxval giving 255.
+ */
+#define PLAIN_MAX_DIGITS 5
+#define PLAIN_TABLE_SIZE 100000
+
+static unsigned char *rescale_table(unsigned int maxval, bool plain)
 {
-    unsigned int val = get_number(fp);
-    return (255 * val + (maxval/2)) / maxval;
+    unsigned int v, n = plain ? PLAIN_TABLE_SIZE : maxval > 255 ? 65536 : 256;
+    unsigned char *table;
+
+    table = malloc(n);
+    if (!table)
+        return NULL;
+
+    for (v = 0; v < maxval && v < n; v++)
+        table[v] = (255 * v + maxval / 2) / maxval;
+    memset(table + v, 255, n - v);
+
+    return table;
+}
+
+static inline unsigned int get_sample(const unsigned char *p, int bytes)
+{
+    return bytes == 2 ? (unsigned int) p[0] << 8 | p[1] : p[0];
 }
 
-static unsigned int get_byte(FILE *fp)
+static int read_plain_bitmap(struct ds_image_stream *stream,
+                             struct color *dst, size_t n)
 {
-    int c;
+    const unsigned char *s = stream->p, *end = stream->end;
+    size_t i = 0;
 
-    c = fgetc(fp);
-    if (c == EOF) {
-	die("end of file\n");
+    /* pixels are single digits, not necessarily separated */
+    for (; s < end && i < n; s++) {
+        if (*s == '0' || *s == '1') {
+            dst[i].red = dst[i].green = dst[i].blue = *s == '0' ? 255 : 0;
+            i++;
+        } else if (*s == '#') {
+            while (s + 1 < end && s[1] != '\n')
+                s++;
+        } else if (*s > ' ') {
+            return -EINVAL;
+        }
     }
 
-    return (unsigned int)c;
+    stream->p = s;
+
+    return i == n ? 0 : -EINVAL;
 }
 
-static unsigned int get_byte255(FILE *fp, unsigned int maxval)
+#define ONES 0x0101010101010101ULL
+
+/* 8 bytes from @p, the first one in the low bits */
+static inline uint64_t load_le64(const unsigned char *p)
 {
-    unsigned int val = get_byte(fp);
-    return (255 * val + (maxval/2)) / maxval;
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+
+    return v;
 }
 
-struct image *ds_read_image(const char *filename)
+/* one bit per byte of @v, from the top bit of each */
+static inline uint64_t byte_mask(uint64_t v)
+{
+    return ((v >> 7 & ONES) * 0x0102040810204080ULL) >> 56;
+}
+
+/*
+ * Scan the 64 bytes at @s: a bit is set in @stop for each one that's not a
+ * digit, and also in @bad if it's not whitespace either. A byte is a digit
+ * if it's >= '0' and not >= ':', whitespace if not >= '!', all found by
+ * adding to it with the top bit out of the way.
+ */
+static inline void scan_plain(const unsigned char *s, uint64_t *stop,
+                              uint64_t *bad)
+{
+    unsigned int k;
+
+    *stop = *bad = 0;
+    for (k = 0; k < 64; k += 8) {
+        uint64_t v = load_le64(s + k), a = v & (0x7f * ONES);
+        uint64_t digit = (a + 0x50 * ONES) & ~(a + 0x46 * ONES) & ~v;
+        uint64_t nondigit = ~digit & (0x80 * ONES);
+
+        *stop |= byte_mask(nondigit) << k;
+        *bad |= byte_mask(nondigit & ((a + 0x5f * ONES) | v)) << k;
+    }
+}
+
+#if defined(ENABLE_SIMD) && defined(__SSE2__)
+/*
+ * Samples of up to 4 digits, or 3 if maxval has no more, are converted
+ * along with the scan, each ending up in @values at the position of its
+ * last digit
+ */
+#define PLAIN_BLOCK_DIGITS(maxval) ((maxval) < 1000 ? 3 : 4)
+
+/* 0xff for each byte of @v that's a digit */
+static inline __m128i digit_mask(__m128i v)
+{
+    return _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char) (0x80 - '0'))),
+                          _mm_set1_epi8((char) (0x80 + 10)));
+}
+
+/*
+ * As scan_plain(), 16 bytes at a time. Each position also gets the value of
+ * the @len digits ending there, from the same bytes loaded 1 to 3 positions
+ * earlier, as far as they are digits too. The caller makes sure those 3
+ * bytes before @s can be read.
+ */
+static inline void scan_plain_values(const unsigned char *s, uint64_t *stop,
+                                     uint64_t *bad, uint16_t *values,
+                                     unsigned int len)
+{
+    const __m128i zero = _mm_setzero_si128(), space = _mm_set1_epi8(' ');
+    const __m128i ascii0 = _mm_set1_epi8('0'), hundred = _mm_set1_epi16(100);
+    uint64_t digit = 0, known = 0;
+    unsigned int k;
+
+    for (k = 0; k < 64; k += 16) {
+        __m128i x0 = _mm_loadu_si128((const __m128i *) (s + k));
+        __m128i x1 = _mm_loadu_si128((const __m128i *) (s + k - 1));
+        __m128i x2 = _mm_loadu_si128((const __m128i *) (s + k - 2));
+        __m128i m0 = digit_mask(x0), m1 = _mm_and_si128(digit_mask(x1), m0);
+        __m128i m2 = _mm_and_si128(digit_mask(x2), m1);
+        __m128i blank = _mm_cmpeq_epi8(_mm_min_epu8(x0, space), x0);
+        __m128i x3, units, hundreds;
+
+        x0 = _mm_and_si128(_mm_sub_epi8(x0, ascii0), m0);
+        x1 = _mm_and_si128(_mm_sub_epi8(x1, ascii0), m1);
+        x2 = _mm_and_si128(_mm_sub_epi8(x2, ascii0), m2);
+
+        /* digits are at most 9, so 10 times one doesn't leave its byte */
+        units = _mm_add_epi8(x0, _mm_add_epi8(_mm_slli_epi16(x1, 3),
+                                              _mm_add_epi8(x1, x1)));
+        hundreds = x2;
+        if (len > 3) {
+            x3 = _mm_loadu_si128((const __m128i *) (s + k - 3));
+            x3 = _mm_and_si128(_mm_sub_epi8(x3, ascii0),
+                               _mm_and_si128(digit_mask(x3), m2));
+            hundreds = _mm_add_epi8(x2, _mm_add_epi8(_mm_slli_epi16(x3, 3),
+                                                     _mm_add_epi8(x3, x3)));
+        }
+
+        _mm_storeu_si128((__m128i *) (values + k), _mm_add_epi16(
+                _mm_unpacklo_epi8(units, zero),
+                _mm_mullo_epi16(_mm_unpacklo_epi8(hundreds, zero), hundred)));
+        _mm_storeu_si128((__m128i *) (values + k + 8), _mm_add_epi16(
+                _mm_unpackhi_epi8(units, zero),
+                _mm_mullo_epi16(_mm_unpackhi_epi8(hundreds, zero), hundred)));
+
+        digit |= (uint64_t) _mm_movemask_epi8(m0) << k;
+        known |= (uint64_t) _mm_movemask_epi8(_mm_or_si128(m0, blank)) << k;
+    }
+
+    *stop = ~digit;
+    *bad = ~known;
+}
+#else
+#define PLAIN_BLOCK_DIGITS(maxval) PLAIN_MAX_DIGITS
+#endif
+
+/*
+ * Value of the @len leading digits of the 8 bytes at @p, 1 to 7 of them.
+ * They're moved to the top, so the ones missing count as leading zeros, and
+ * then pairs of digits, of 2 digit numbers and of 4 digit numbers are
+ * merged in turn. Whatever followed the digits is shifted out, with any
+ * borrow it caused.
+ */
+static inline unsigned int digits_value(const unsigned char *p,
+                                        unsigned int len)
+{
+    uint64_t v = load_le64(p);
+
+    v = (v - 0x30 * ONES) << (8 * (8 - len));
+    v = (v * 10 + (v >> 8)) & 0x00ff00ff00ff00ffULL;
+    v = (v * 100 + (v >> 16)) & 0x0000ffff0000ffffULL;
+    v = (v * 10000 + (v >> 32)) & 0xffffffffULL;
+
+    return v;
+}
+
+/*
+ * Samples are found 64 bytes at a time, from a mask of the bytes that end
+ * them, and each is converted on its own or, with SSE2, all of them along
+ * with the scan. Nothing depends on the sample before, so they don't wait
+ * on each other. Comments, anything bad, samples with too many digits and
+ * the last bytes of the file go through a byte at a time loop, where
+ * anything not a digit ends the current sample.
+ */
+static int read_plain(struct ds_image_stream *stream, struct color *pixels,
+                      size_t n)
+{
+    const unsigned char *s = stream->p, *end = stream->end;
+    const unsigned char *table = stream->table;
+    unsigned char *dst = (unsigned char *) pixels;
+    size_t i = 0, total = n * stream->channels;
+    unsigned int d, val = 0, max_len = PLAIN_BLOCK_DIGITS(stream->maxval);
+    bool digits = false;
+
+    /*
+     * Always at a separator or at the start of a sample, with at least the
+     * magic number and a separator before
+     */
+    while (i < total && end - s >= 64 + 8) {
+        uint64_t stop, bad, run, ends;
+        unsigned int p, count, k, next = 64;
+        bool slow = false;
+#if defined(ENABLE_SIMD) && defined(__SSE2__)
+        uint16_t values[64];
+
+        scan_plain_values(s, &stop, &bad, values, max_len);
+#else
+        unsigned int len;
+
+        scan_plain(s, &stop, &bad);
+#endif
+        /* a sample going past these 64 bytes is taken from the next ones */
+        if (stop) {
+            next = 64 - __builtin_clzll(stop);
+            stop |= ~0ULL << (next - 1);
+        } else {
+            next = 0;
+            slow = true;
+        }
+
+        if (bad) {
+            next = __builtin_ctzll(bad);
+            stop |= ~0ULL << next;
+            slow = true;
+        }
+
+        /* the first sample with too many digits is left to the slow loop */
+        for (run = ~stop, k = 1; k <= max_len; k++)
+            run &= ~stop >> k;
+        if (run) {
+            next = __builtin_ctzll(run);
+            stop |= ~0ULL << next;
+            slow = true;
+        }
+
+        /* and the ones past the requested rows to the next read */
+        ends = ~stop & stop >> 1;
+        count = __builtin_popcountll(ends);
+        if (ends && count >= total - i) {
+            for (; count > total - i; count--)
+                ends &= ~(1ULL << (63 - __builtin_clzll(ends)));
+            next = 64 - __builtin_clzll(ends);
+            slow = false;
+        }
+
+        for (; ends; ends &= ends - 1) {
+            p = __builtin_ctzll(ends);
+#if defined(ENABLE_SIMD) && defined(__SSE2__)
+            dst[i++] = table[values[p]];
+#else
+            len = __builtin_clzll((stop << 1 | 1) << (62 - p));
+            dst[i++] = table[digits_value(s + p + 1 - len, len)];
+#endif
+        }
+
+        s += next;
+        if (!slow)
+            continue;
+
+        if (*s == '#') {
+            while (s + 1 < end && s[1] != '\n')
+                s++;
+            s++;
+        } else if ((d = *s - '0') <= 9) {
+            for (val = 0; s < end && (d = *s - '0') <= 9; s++)
+                val = MIN(10 * val + d, PLAIN_TABLE_SIZE - 1);
+            dst[i++] = table[val];
+        } else {
+            return -EINVAL;
+        }
+    }
+
+    for (val = 0; s < end && i < total; s++) {
+        d = *s - '0';
+        if (d <= 9) {
+            val = MIN(10 * val + d, PLAIN_TABLE_SIZE - 1);
+            digits = true;
+            continue;
+        }
+
+        if (digits) {
+            dst[i++] = table[val];
+            val = 0;
+            digits = false;
+        }
+
+        if (*s == '#') {
+            while (s + 1 < end && s[1] != '\n')
+                s++;
+        } else if (*s > ' ') {
+            return -EINVAL;
+        }
+    }
+
+    /* the last sample may end the file */
+    if (digits && i < total)
+        dst[i++] = table[val];
+
+    if (i < total)
+        return -EINVAL;
+
+    /* graymap samples were packed at the start, spread them backwards */
+    if (stream->channels == 1) {
+        for (i = n; i-- > 0;)
+            pixels[i].red = pixels[i].green = pixels[i].blue = dst[i];
+    }
+
+    stream->p = s;
+
+    return 0;
+}
+
+static int read_raw_bitmap(struct ds_image_stream *stream, struct color *dst,
+                           unsigned int rows)
+{
+    size_t row = (stream->width + 7) / 8;
+    unsigned int x, y;
+
+    if ((size_t)(stream->end - stream->p) / row < rows)
+        return -EINVAL;
+
+    for (y = 0; y < rows; y++, stream->p += row) {
+        for (x = 0; x < stream->width; x++, dst++) {
+            int set = stream->p[x >> 3] & (0x80 >> (x & 7));
+
+            dst->red = dst->green = dst->blue = set ? 0 : 255;
+        }
+    }
+
+    return 0;
+}
+
+static int read_raw(struct ds_image_stream *stream, struct color *dst,
+                    size_t n)
+{
+    int bytes = stream->maxval > 255 ? 2 : 1;
+    const unsigned char *table = stream->table;
+    const unsigned char *p = stream->p;
+    size_t i;
+
+    if ((size_t)(stream->end - p) / (stream->channels * bytes) < n)
+        return -EINVAL;
+
+    stream->p += n * stream->channels * bytes;
+
+    /* already laid out as our pixels */
+    if (stream->channels == 3 && stream->maxval == 255) {
+        memcpy(dst, p, n * sizeof(struct color));
+        return 0;
+    }
+
+    if (stream->channels == 3) {
+        for (i = 0; i < n; i++, p += 3 * bytes) {
+            dst[i].red = table[get_sample(p, bytes)];
+            dst[i].green = table[get_sample(p + bytes, bytes)];
+            dst[i].blue = table[get_sample(p + 2 * bytes, bytes)];
+        }
+    } else {
+        for (i = 0; i < n; i++, p += bytes)
+            dst[i].red = dst[i].green = dst[i].blue =
+                table[get_sample(p, bytes)];
+    }
+
+    return 0;
+}
+
+/* packets may span reads, the remainder of the last one is kept */
+static int read_rle(struct ds_image_stream *stream, struct color *dst,
+                    size_t n)
+{
+    struct ds_rle_packet *packet = &stream->packet;
+    size_t i = 0, k, count;
+
+    while (i < n) {
+        if (!packet->count && ds_rle_next(&stream->rle, packet) <= 0)
+            return -EINVAL;
+
+        count = MIN(packet->count, n - i);
+        if (packet->run) {
+            for (k = 0; k < count; k++)
+                dst[i + k] = packet->pixels[0];
+        } else {
+            memcpy(dst + i, packet->pixels, count * sizeof(struct color));
+            packet->pixels += count;
+        }
+
+        packet->count -= count;
+        i += count;
+    }
+
+    return 0;
+}
+
+static int read_rle_header(struct ds_image_stream *stream)
+{
+    int ret;
+
+    ret = ds_rle_init(&stream->rle, stream->p, stream->end - stream->p);
+    if (ret < 0)
+        return ret;
+
+    stream->magic = 'R';
+    stream->width = stream->rle.width;
+    stream->height = stream->rle.height;
+
+    return 0;
+}
+
+static int read_png_header(struct ds_image_stream *stream)
+{
+    int ret;
+
+    ret = ds_png_init(&stream->png, stream->p, stream->end - stream->p);
+    if (ret < 0)
+        return ret;
+
+    stream->magic = 'N';
+    stream->width = stream->png.width;
+    stream->height = stream->png.height;
+
+    return 0;
+}
+
+static int read_pnm_header(struct ds_image_stream *stream)
 {
-    FILE *fp;
-    unsigned int i, j;
+    long width, height, maxval = 1;
+    const unsigned char *p = stream->p, *end = stream->end;
     int magic;
-    unsigned int maxval;
-    struct image *logo, *tmp;
-
-    /* open image file */
-    fp = fopen(filename, "r");
-    if (!fp)
-	die("Cannot open file %s: %m\n", filename);
-
-    /* check file type and read file header */
-    magic = fgetc(fp);
-    if (magic != 'P')
-	die("%s is not a PNM file\n", filename);
-    magic = fgetc(fp);
-    switch (magic) {
-	case '1':
-	case '2':
-	case '3':
-	    /* Plain PBM/PGM/PPM */
-	    break;
-
-	case '4':
-	case '5':
-	case '6':
-	    /* Binary PBM/PGM/PPM */
-	    break;
-
-	default:
-	    die("%s is not a PNM file\n", filename);
-    }
-
-    logo = malloc(sizeof(*logo));
-    if (!logo)
-        die("%m\n");
-
-    logo->width = get_number(fp);
-    logo->height = get_number(fp);
-
-    /* allocate image data */
-    tmp = realloc(logo, sizeof(*logo) + logo->height * logo->width *
-                            sizeof(struct color));
-    if (!tmp) {
-        free(logo);
-	die("%m\n");
-    }
-    logo = tmp;
-
-    /* read image data */
-    switch (magic) {
-	case '1':
-	    /* Plain PBM */
-            for (i = 0; i < logo->height * logo->width; i++)
-                logo->pixels[i].red = logo->pixels[i].green =
-			logo->pixels[i].blue = 255 * (1 - get_number(fp));
-	    break;
-
-	case '2':
-	    /* Plain PGM */
-	    maxval = get_number(fp);
-	    for (i = 0; i < logo->height * logo->width; i++)
-                logo->pixels[i].red = logo->pixels[i].green =
-			logo->pixels[i].blue = get_number255(fp, maxval);
-	    break;
-
-	case '3':
-	    /* Plain PPM */
-	    maxval = get_number(fp);
-	    for (i = 0; i < logo->height * logo->width; i++) {
-		    logo->pixels[i].red = get_number255(fp, maxval);
-		    logo->pixels[i].green = get_number255(fp, maxval);
-		    logo->pixels[i].blue = get_number255(fp, maxval);
-            }
-	    break;
-
-	case '4':
-	    /* Binary PBM */
-	    {
-	    struct color * pDst = &logo->pixels[0];
-	    for (i = 0; i < logo->height; ++i) {
-		    for (j = 0; j < (logo->width/8); ++j) {
-			    unsigned int val = get_byte(fp);
-			    pDst->red = pDst->green = pDst->blue = ((val & 0x80) ? 0 : 255); ++pDst;
-			    pDst->red = pDst->green = pDst->blue = ((val & 0x40) ? 0 : 255); ++pDst;
-			    pDst->red = pDst->green = pDst->blue = ((val & 0x20) ? 0 : 255); ++pDst;
-			    pDst->red = pDst->green = pDst->blue = ((val & 0x10) ? 0 : 255); ++pDst;
-			    pDst->red = pDst->green = pDst->blue = ((val & 0x08) ? 0 : 255); ++pDst;
-			    pDst->red = pDst->green = pDst->blue = ((val & 0x04) ? 0 : 255); ++pDst;
-			    pDst->red = pDst->green = pDst->blue = ((val & 0x02) ? 0 : 255); ++pDst;
-			    pDst->red = pDst->green = pDst->blue = ((val & 0x01) ? 0 : 255); ++pDst;
-		    }
-		    if (logo->width % 8 != 0) {
-			unsigned int val = get_byte(fp);
-			unsigned int msk = 0x80;
-			for (j = 0; j < (logo->width % 8); ++j) {
-			    pDst->red = pDst->green = pDst->blue = ((val & msk) ? 0 : 255);
-			    ++pDst;
-			    msk >>= 1;
-			}
-		    }
-	    }
-	    }
-	    break;
-
-	case '5':
-	    /* Binary PGM */
-	    maxval = get_number(fp);
-	    for (i = 0; i < logo->height * logo->width; i++)
-                logo->pixels[i].red = logo->pixels[i].green =
-			logo->pixels[i].blue = get_byte255(fp, maxval);
-	    break;
-
-	case '6':
-	    /* Binary PPM */
-	    maxval = get_number(fp);
-	    for (i = 0; i < logo->height * logo->width; i++) {
-		    logo->pixels[i].red = get_byte255(fp, maxval);
-		    logo->pixels[i].green = get_byte255(fp, maxval);
-		    logo->pixels[i].blue = get_byte255(fp, maxval);
-            }
-	    break;
+
+    if (end - p < 2 || p[0] != 'P' || p[1] < '1' || p[1] > '6')
+        return -EINVAL;
+
+    magic = p[1];
+    p += 2;
+
+    p = get_number(p, end, &width);
+    if (p)
+        p = get_number(p, end, &height);
+    if (p && magic != '1' && magic != '4')
+        p = get_number(p, end, &maxval);
+
+    if (!p || !width || !height || !maxval)
+        return -EINVAL;
+
+    /* a single whitespace separates the header of raw formats from data */
+    if (magic >= '4') {
+        if (p == end || *p > ' ')
+            return -EINVAL;
+        p++;
+    }
+
+    if (magic == '2' || magic == '3' || magic == '5' || magic == '6') {
+        stream->table = rescale_table(maxval, magic <= '3');
+        if (!stream->table)
+            return -ENOMEM;
+    }
+
+    stream->p = p;
+    stream->magic = magic;
+    stream->channels = (magic == '3' || magic == '6') ? 3 : 1;
+    stream->width = width;
+    stream->height = height;
+    stream->maxval = maxval;
+
+    return 0;
+}
+
+static struct ds_image_stream *stream_new(const void *data, size_t size)
+{
+    struct ds_image_stream *stream;
+    int ret;
+
+    stream = calloc(1, sizeof(*stream));
+    if (!stream)
+        return NULL;
+
+    stream->p = data;
+    stream->end = stream->p + size;
+
+    if (size >= 4 && !memcmp(data, DS_RLE_MAGIC, 4))
+        ret = read_rle_header(stream);
+    else if (size >= DS_PNG_MAGIC_SIZE &&
+             !memcmp(data, DS_PNG_MAGIC, DS_PNG_MAGIC_SIZE))
+        ret = read_png_header(stream);
+    else
+        ret = read_pnm_header(stream);
+
+    if (ret < 0) {
+        free(stream);
+        errno = -ret;
+        return NULL;
+    }
+
+    return stream;
+}
+
+static struct ds_image_stream *stream_open(const char *filename, int flags)
+{
+    struct ds_image_stream *stream;
+    struct stat st;
+    void *map;
+    int fd, ret;
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) < 0)
+        goto close_on_err;
+
+    if (!st.st_size) {
+        errno = EINVAL;
+        goto close_on_err;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | flags, fd, 0);
+    if (map == MAP_FAILED)
+        goto close_on_err;
+
+    close(fd);
+
+    stream = stream_new(map, st.st_size);
+    if (!stream) {
+        ret = errno;
+        munmap(map, st.st_size);
+        errno = ret;
+        return NULL;
+    }
+
+    stream->map = map;
+    stream->map_size = st.st_size;
+
+    return stream;
+
+close_on_err:
+    ret = errno;
+    close(fd);
+    errno = ret;
+    return NULL;
+}
+
+/**
+ * Start decoding the PNM, PNG or RLE image held in the @size bytes at @data,
+ * which must stay around until the stream is closed
+ *
+ * @return the stream or NULL with errno set, EINVAL if it's malformed
+ */
+struct ds_image_stream *ds_image_stream_new(const void *data, size_t size)
+{
+    return stream_new(data, size);
+}
+
+/**
+ * Start decoding the PNM, PNG or RLE image in @filename. Pages of the file are
+ * read as decoding goes, and are not needed anymore once it's past them.
+ *
+ * @return the stream or NULL with errno set, EINVAL if it's malformed
+ */
+struct ds_image_stream *ds_image_stream_open(const char *filename)
+{
+    struct ds_image_stream *stream = stream_open(filename, 0);
+
+    if (stream)
+        madvise(stream->map, stream->map_size, MADV_SEQUENTIAL);
+
+    return stream;
+}
+
+void ds_image_stream_size(const struct ds_image_stream *stream,
+                          unsigned int *width, unsigned int *height)
+{
+    *width = stream->width;
+    *height = stream->height;
+}
+
+/**
+ * Decode the next @rows rows of @stream into @pixels, which must have room
+ * for @rows times its width
+ *
+ * @return 0 on success or a negative errno, -EINVAL if the image is
+ * malformed or truncated, or if it has less than @rows rows left
+ */
+int ds_image_stream_read(struct ds_image_stream *stream,
+                         struct color *pixels, unsigned int rows)
+{
+    size_t n = (size_t) rows * stream->width;
+    int ret;
+
+    if (rows > stream->height - stream->row)
+        return -EINVAL;
+
+    switch (stream->magic) {
+    case '1':
+        ret = read_plain_bitmap(stream, pixels, n);
+        break;
+    case '2':
+    case '3':
+        ret = read_plain(stream, pixels, n);
+        break;
+    case '4':
+        ret = read_raw_bitmap(stream, pixels, rows);
+        break;
+    case 'R':
+        ret = read_rle(stream, pixels, n);
+        break;
+    case 'N':
+        ret = ds_png_read(&stream->png, pixels, rows);
+        break;
+    default:
+        ret = read_raw(stream, pixels, n);
+        break;
     }
 
-    /* close file */
-    fclose(fp);
+    if (ret < 0)
+        return ret;
+
+    stream->row += rows;
+
+    /* a packet going past the last pixel means the encoder went wrong */
+    if (stream->row == stream->height && stream->packet.count)
+        return -EINVAL;
+
+    return 0;
+}
+
+void ds_image_stream_close(struct ds_image_stream *stream)
+{
+    if (stream->map)
+        munmap(stream->map, stream->map_size);
+
+    if (stream->magic == 'N')
+        ds_png_release(&stream->png);
+
+    free(stream->table);
+    free(stream);
+}
+
+static struct image *read_image(struct ds_image_stream *stream)
+{
+    struct image *logo;
+    size_t n;
+    int ret;
+
+    if (!stream)
+        return NULL;
+
+    /* fits on 64 bits, but not always on 32 */
+    n = (size_t) stream->width * stream->height;
+    if (n / stream->width != stream->height ||
+        n > (SIZE_MAX - sizeof(*logo)) / sizeof(struct color)) {
+        ds_image_stream_close(stream);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    logo = malloc(sizeof(*logo) + n * sizeof(struct color));
+    if (!logo) {
+        ds_image_stream_close(stream);
+        return NULL;
+    }
+
+    logo->width = stream->width;
+    logo->height = stream->height;
+
+    ret = ds_image_stream_read(stream, logo->pixels, logo->height);
+    ds_image_stream_close(stream);
+
+    if (ret < 0) {
+        free(logo);
+        errno = -ret;
+        return NULL;
+    }
 
     return logo;
 }
 
+/**
+ * Expand the PNM, PNG or RLE image held in the @size bytes at @data
+ *
+ * @return the image, to be released with free(), or NULL with errno set
+ */
+struct image *ds_read_image_data(const void *data, size_t size)
+{
+    return read_image(stream_new(data, size));
+}
+
+/**
+ * Load a PNM file, in any of its plain or raw variants, a PNG or an RLE
+ * image
+ *
+ * @return the image, to be released with free(), or NULL with errno set.
+ * EINVAL means the file is malformed or truncated, ENOTSUP that it's an
+ * interlaced PNG.
+ */
+struct image *ds_read_image(const char *filename)
+{
+    return read_image(stream_open(filename, MAP_POPULATE));
+}
+
+/* slots of the table colors are looked up in, twice as many as there may be */
+#define INDEX_HASH_BITS 9
+
+/**
+ * Turn @img into an indexed image, colors numbered in the order they first
+ * appear
+ *
+ * @return the image, to be released with free(), or NULL with errno set,
+ * ERANGE if @img has more than 256 colors
+ */
+struct indexed_image *ds_image_index(const struct image *img)
+{
+    uint32_t keys[1 << INDEX_HASH_BITS];
+    unsigned char index[1 << INDEX_HASH_BITS];
+    size_t i, n = (size_t) img->width * img->height;
+    struct indexed_image *indexed;
+    uint32_t key, last = UINT32_MAX;
+    unsigned int h = 0;
+
+    indexed = malloc(sizeof(*indexed) + n);
+    if (!indexed)
+        return NULL;
+
+    indexed->width = img->width;
+    indexed->height = img->height;
+    indexed->colors = 0;
+    memset(indexed->palette, 0, sizeof(indexed->palette));
+
+    /* no color has the top byte set, so that's an empty slot */
+    memset(keys, 0xff, sizeof(keys));
+
+    for (i = 0; i < n; i++) {
+        const struct color *c = &img->pixels[i];
+
+        key = (uint32_t) c->red << 16 | c->green << 8 | c->blue;
+
+        /* runs of the same color are the common case */
+        if (key != last) {
+            h = (key * 2654435761u) >> (32 - INDEX_HASH_BITS);
+            while (keys[h] != key && keys[h] != UINT32_MAX)
+                h = (h + 1) & ((1 << INDEX_HASH_BITS) - 1);
+
+            if (keys[h] == UINT32_MAX) {
+                if (indexed->colors == ARRAY_SIZE(indexed->palette)) {
+                    free(indexed);
+                    errno = ERANGE;
+                    return NULL;
+                }
+
+                keys[h] = key;
+                index[h] = indexed->colors;
+                indexed->palette[indexed->colors++] = *c;
+            }
+
+            last = key;
+        }
+
+        indexed->pixels[i] = index[h];
+    }
+
+    return indexed;
+}
+
+/**
+ * Expand @img back to RGB, for what can't work on indices, like scaling
+ *
+ * @return the image, to be released with free(), or NULL with errno set
+ */
+struct image *ds_indexed_to_image(const struct indexed_image *img)
+{
+    size_t i, n = (size_t) img->width * img->height;
+    struct image *rgb;
+
+    rgb = malloc(sizeof(*rgb) + n * sizeof(struct color));
+    if (!rgb)
+        return NULL;
+
+    rgb->width = img->width;
+    rgb->height = img->height;
+
+    for (i = 0; i < n; i++)
+        rgb->pixels[i] = img->palette[img->pixels[i]];
+
+    return rgb;
+}
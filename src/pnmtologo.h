@@ -28,6 +28,11 @@
 #ifndef __DIETSPLASH_PNMTOLOGO_H
 #define __DIETSPLASH_PNMTOLOGO_H
 
+#include <stddef.h>
+
+/* largest width or height of an image, whatever its format */
+#define DS_IMAGE_MAX_SIZE 65535
+
 struct color {
     unsigned char red;
     unsigned char green;
@@ -40,6 +45,63 @@ struct image {
     struct color pixels[];
 };
 
+/*
+ * Image of at most 256 colors, one byte per pixel indexing @palette
+ */
+struct indexed_image {
+    unsigned int width;
+    unsigned int height;
+    unsigned int colors;
+    struct color palette[256];
+    unsigned char pixels[];
+};
+
+/*
+ * Area of an animation frame that differs from the previous one. Its
+ * pixels are at (@atlas_x, @atlas_y) of the atlas of the animation.
+ */
+struct delta_rect {
+    unsigned short x;
+    unsigned short y;
+    unsigned short width;
+    unsigned short height;
+    unsigned short atlas_x;
+    unsigned short atlas_y;
+};
+
+/* what changes to show a frame: @n_rects rects, from rect @first */
+struct delta_frame {
+    unsigned int first;
+    unsigned int n_rects;
+};
+
+/*
+ * Font of @n_glyphs glyphs, all @width x @height pixels, for the characters
+ * from @first on. Each row of a glyph takes (@width + 7) / 8 bytes of
+ * @bits, leftmost pixel in the top bit.
+ */
+struct bitmap_font {
+    unsigned int width;
+    unsigned int height;
+    unsigned int first;
+    unsigned int n_glyphs;
+    const unsigned char *bits;
+};
+
+struct ds_image_stream;
+
 struct image *ds_read_image(const char *filename);
+struct image *ds_read_image_data(const void *data, size_t size);
+
+struct ds_image_stream *ds_image_stream_open(const char *filename);
+struct ds_image_stream *ds_image_stream_new(const void *data, size_t size);
+void ds_image_stream_size(const struct ds_image_stream *stream,
+                          unsigned int *width, unsigned int *height);
+int ds_image_stream_read(struct ds_image_stream *stream,
+                         struct color *pixels, unsigned int rows);
+void ds_image_stream_close(struct ds_image_stream *stream);
+
+struct indexed_image *ds_image_index(const struct image *img);
+struct image *ds_indexed_to_image(const struct indexed_image *img);
 
 #endif
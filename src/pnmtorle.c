@@ -0,0 +1,62 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * pnmtorle.c - encode a PNM image in the dietsplash RLE format
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "pnmtologo.h"
+#include "rle.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *USAGE = "USAGE: pnmtorle infile.ppm outfile.rle";
+
+int main(int argc, char *argv[])
+{
+    struct image *img;
+    FILE *fp;
+
+    if (argc != 3)
+        die("%s", USAGE);
+
+    img = ds_read_image(argv[1]);
+    if (!img)
+        die("Cannot read file %s: %m\n", argv[1]);
+
+    if (strcmp(argv[2], "-")) {
+        fp = fopen(argv[2], "w");
+        if (!fp)
+            die("Cannot create file %s: %m\n", argv[2]);
+    } else {
+        fp = stdout;
+    }
+
+    if (ds_rle_encode(img, fp) < 0 || fclose(fp) == EOF)
+        die("Cannot write file %s: %m\n", argv[2]);
+
+    free(img);
+
+    return 0;
+}
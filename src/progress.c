@@ -0,0 +1,137 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * progress.c - bar showing the boot progress
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+/*
+ * The bar is drawn empty once, then every change of the percentage only
+ * paints the slice between the old and the new end of the filled part:
+ * with the fill color when it grows, with the empty one when it shrinks.
+ * A burst of updates from dietsplashctl costs the pixels that changed, the
+ * rest of the bar and the background are never touched again.
+ */
+
+#include "log.h"
+#include "fb.h"
+#include "pnmtologo.h"
+#include "progress.h"
+#include "util.h"
+
+#include <assert.h>
+
+#define COLOR(_rgb) { ((_rgb) >> 16) & 0xff, ((_rgb) >> 8) & 0xff, (_rgb) & 0xff }
+
+static const struct color _fill_color = COLOR(PROGRESS_COLOR);
+static const struct color _empty_color = COLOR(PROGRESS_BG_COLOR);
+
+static struct {
+    struct ds_fb *fb;
+    /* where the bar is on screen */
+    struct ds_rect area;
+    /* width of its filled part */
+    long filled;
+} _progress;
+
+/* thinner bars are hard to see on a large screen */
+#define PROGRESS_MIN_HEIGHT 8
+
+/**
+ * Where the bar goes on @fb. By default it's three quarters as wide as the
+ * part of the background on screen, centered, right below it or, if it
+ * reaches the bottom of the screen, as close to it as the bar fits.
+ */
+void ds_progress_area(const struct ds_fb *fb, struct ds_rect *area)
+{
+    const struct ds_rect *bg = &fb->bg_area;
+
+#ifdef PROGRESS_X
+    area->x = bg->x + PROGRESS_X;
+    area->y = bg->y + PROGRESS_Y;
+    area->w = PROGRESS_WIDTH;
+    area->h = PROGRESS_HEIGHT;
+#else
+    long x1 = MAX(bg->x, 0), x2 = MIN(bg->x + bg->w, (long) fb->xres);
+    long y1 = MAX(bg->y, 0), y2 = MIN(bg->y + bg->h, (long) fb->yres);
+
+    area->w = MAX(x2 - x1, 0) * 3 / 4;
+    area->h = MAX((y2 - y1) / 32, PROGRESS_MIN_HEIGHT);
+    area->x = x1 + (x2 - x1 - area->w) / 2;
+    area->y = MIN(bg->y + bg->h + area->h, (long) fb->yres - area->h * 2);
+#endif
+}
+
+/**
+ * Draw the empty bar over the background on @fb. Must be called after the
+ * background is drawn.
+ */
+void ds_progress_start(struct ds_fb *fb)
+{
+    assert(fb);
+
+    _progress.fb = fb;
+    _progress.filled = 0;
+    ds_progress_area(fb, &_progress.area);
+
+    inf("progress bar %ldx%ld at %ld,%ld", _progress.area.w, _progress.area.h,
+        _progress.area.x, _progress.area.y);
+
+#ifdef PROGRESS_X
+    /* only the part on screen is drawn */
+    if (_progress.area.x < 0 || _progress.area.y < 0 ||
+        _progress.area.x + _progress.area.w > fb->xres ||
+        _progress.area.y + _progress.area.h > fb->yres)
+        wrn("progress bar is not all on the %dx%d screen, check "
+            "--with-progress-geometry", fb->xres, fb->yres);
+#endif
+
+    ds_fb_fill(fb, _progress.area.x, _progress.area.y, _progress.area.w,
+               _progress.area.h, &_empty_color);
+    ds_fb_flush(fb);
+}
+
+/**
+ * Show @perc percent of the bar filled, above 100 meaning full. Only the
+ * slice that changed since the last call is drawn.
+ */
+void ds_progress_set(unsigned int perc)
+{
+    const struct ds_rect *area = &_progress.area;
+    long filled;
+
+    if (!_progress.fb)
+        return;
+
+    filled = area->w * MIN(perc, 100U) / 100;
+    if (filled == _progress.filled)
+        return;
+
+    if (filled > _progress.filled)
+        ds_fb_fill(_progress.fb, area->x + _progress.filled, area->y,
+                   filled - _progress.filled, area->h, &_fill_color);
+    else
+        ds_fb_fill(_progress.fb, area->x + filled, area->y,
+                   _progress.filled - filled, area->h, &_empty_color);
+
+    _progress.filled = filled;
+    ds_fb_flush(_progress.fb);
+}
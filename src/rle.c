@@ -0,0 +1,175 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * rle.c - run-length encoded images
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "pnmtologo.h"
+#include "rle.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Longest LEB128 number we accept: 28 bits, the lowest of them telling runs
+ * from literals, so a packet covers at most 2^27 pixels
+ */
+#define RLE_MAX_COUNT_BYTES 4
+#define RLE_MAX_COUNT (1UL << (7 * RLE_MAX_COUNT_BYTES - 1))
+
+static inline uint32_t _le32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/**
+ * Start reading the RLE image in @data. Nothing is copied: @data must stay
+ * around while packets are read.
+ *
+ * @return 0 on success or -EINVAL if @data is not an RLE image
+ */
+int ds_rle_init(struct ds_rle *rle, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+
+    if (size < DS_RLE_HEADER_SIZE || memcmp(p, DS_RLE_MAGIC, 4))
+        return -EINVAL;
+
+    rle->width = _le32(p + 4);
+    rle->height = _le32(p + 8);
+    if (!rle->width || !rle->height ||
+        rle->width > DS_IMAGE_MAX_SIZE || rle->height > DS_IMAGE_MAX_SIZE)
+        return -EINVAL;
+
+    rle->p = p + DS_RLE_HEADER_SIZE;
+    rle->end = p + size;
+
+    return 0;
+}
+
+/**
+ * Read the next packet of @rle
+ *
+ * @return 1 if @packet was filled, 0 at the end of data or -EINVAL if it's
+ * truncated
+ */
+int ds_rle_next(struct ds_rle *rle, struct ds_rle_packet *packet)
+{
+    const unsigned char *p = rle->p;
+    unsigned long n = 0;
+    size_t len;
+    int i;
+
+    if (p == rle->end)
+        return 0;
+
+    for (i = 0;; i++) {
+        if (p == rle->end || i == RLE_MAX_COUNT_BYTES)
+            return -EINVAL;
+
+        n |= (unsigned long)(*p & 0x7f) << (7 * i);
+        if (!(*p++ & 0x80))
+            break;
+    }
+
+    packet->run = n & 1;
+    packet->count = (n >> 1) + 1;
+
+    len = (packet->run ? 1 : packet->count) * sizeof(struct color);
+    if ((size_t)(rle->end - p) < len)
+        return -EINVAL;
+
+    packet->pixels = (const struct color *) p;
+    rle->p = p + len;
+
+    return 1;
+}
+
+static void _rle_put_le32(uint32_t v, FILE *fp)
+{
+    fputc(v & 0xff, fp);
+    fputc(v >> 8 & 0xff, fp);
+    fputc(v >> 16 & 0xff, fp);
+    fputc(v >> 24, fp);
+}
+
+/* longer runs and literals are split so they can be read back */
+static void _rle_put_packet(FILE *fp, const struct color *pixels,
+                            size_t count, bool run)
+{
+    while (count) {
+        size_t len = MIN(count, RLE_MAX_COUNT);
+        unsigned long n = (unsigned long)(len - 1) << 1 | run;
+
+        for (; n >= 0x80; n >>= 7)
+            fputc((n & 0x7f) | 0x80, fp);
+        fputc(n, fp);
+
+        fwrite(pixels, sizeof(*pixels), run ? 1 : len, fp);
+        if (!run)
+            pixels += len;
+        count -= len;
+    }
+}
+
+static inline bool _rle_same(const struct color *a, const struct color *b)
+{
+    return a->red == b->red && a->green == b->green && a->blue == b->blue;
+}
+
+/**
+ * Write @img to @fp. Any two or more equal pixels in a row become a run,
+ * anything else goes in literals.
+ *
+ * @return 0 on success or -EIO
+ */
+int ds_rle_encode(const struct image *img, FILE *fp)
+{
+    const struct color *px = img->pixels;
+    size_t i = 0, j, literal = 0, n = (size_t) img->width * img->height;
+
+    fwrite(DS_RLE_MAGIC, 1, 4, fp);
+    _rle_put_le32(img->width, fp);
+    _rle_put_le32(img->height, fp);
+
+    while (i < n) {
+        for (j = i + 1; j < n && _rle_same(px + j, px + i); j++)
+            ;
+
+        if (j - i < 2) {
+            i++;
+            continue;
+        }
+
+        if (literal < i)
+            _rle_put_packet(fp, px + literal, i - literal, false);
+        _rle_put_packet(fp, px + i, j - i, true);
+        i = literal = j;
+    }
+
+    if (literal < n)
+        _rle_put_packet(fp, px + literal, n - literal, false);
+
+    return ferror(fp) ? -EIO : 0;
+}
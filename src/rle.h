@@ -0,0 +1,67 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * rle.h - run-length encoded images
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#ifndef __DIETSPLASH_RLE_H
+#define __DIETSPLASH_RLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+struct color;
+struct image;
+
+/*
+ * Layout of an RLE image, integers in little endian:
+ *
+ *   "DSRL", width (32 bits), height (32 bits)
+ *   packets, until width * height pixels are covered
+ *
+ * Each packet starts with a LEB128 number n and covers (n >> 1) + 1
+ * pixels, possibly spanning rows. If n is odd it's a run and a single RGB
+ * pixel follows, repeated for all of them. Otherwise it's a literal and
+ * that many RGB pixels follow.
+ */
+#define DS_RLE_MAGIC "DSRL"
+#define DS_RLE_HEADER_SIZE 12
+
+struct ds_rle {
+    unsigned int width;
+    unsigned int height;
+    const unsigned char *p;
+    const unsigned char *end;
+};
+
+struct ds_rle_packet {
+    unsigned long count;
+    bool run;
+    const struct color *pixels; /* points into the encoded data */
+};
+
+int ds_rle_init(struct ds_rle *rle, const void *data, size_t size);
+int ds_rle_next(struct ds_rle *rle, struct ds_rle_packet *packet);
+int ds_rle_encode(const struct image *img, FILE *fp);
+
+#endif
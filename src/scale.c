@@ -0,0 +1,386 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * scale.c - resampling of images to the framebuffer resolution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "log.h"
+#include "band.h"
+#include "fb.h"
+#include "pnmtologo.h"
+#include "scale.h"
+#include "surface.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(ENABLE_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(ENABLE_SIMD) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* weights are fixed point with 8 bits of fraction */
+#define SCALE_SHIFT 8
+#define SCALE_ONE (1 << SCALE_SHIFT)
+
+/*
+ * Where a destination pixel comes from along one axis: @idx in the source,
+ * blended with @idx + 1 by @frac / SCALE_ONE. @frac is 0 when there's
+ * nothing to blend, which is always the case for nearest neighbour.
+ */
+struct tap {
+    long idx;
+    unsigned int frac;
+};
+
+static const char * const _modes[] = {
+    [DS_SCALE_NONE] = "none",
+    [DS_SCALE_FIT] = "fit",
+    [DS_SCALE_FILL] = "fill",
+    [DS_SCALE_STRETCH] = "stretch",
+};
+
+static const char * const _filters[] = {
+    [DS_SCALE_BILINEAR] = "bilinear",
+    [DS_SCALE_NEAREST] = "nearest",
+};
+
+static int _scale_lookup(const char * const *names, int n, const char *s,
+                         size_t len)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (strlen(names[i]) == len && !strncasecmp(names[i], s, len))
+            return i;
+
+    return -1;
+}
+
+/**
+ * Parse a scaling spec of the form "mode[:filter]", e.g. "fit" or
+ * "fill:nearest". The filter defaults to bilinear.
+ *
+ * @return 0 on success or -EINVAL if @spec is not understood
+ */
+int ds_scale_parse(const char *spec, enum ds_scale_mode *mode,
+                   enum ds_scale_filter *filter)
+{
+    const char *sep = strchr(spec, ':');
+    int m, f = DS_SCALE_BILINEAR;
+
+    m = _scale_lookup(_modes, ARRAY_SIZE(_modes), spec,
+                      sep ? (size_t)(sep - spec) : strlen(spec));
+    if (m < 0)
+        return -EINVAL;
+
+    if (sep) {
+        f = _scale_lookup(_filters, ARRAY_SIZE(_filters), sep + 1,
+                          strlen(sep + 1));
+        if (f < 0)
+            return -EINVAL;
+    }
+
+    *mode = m;
+    *filter = f;
+
+    return 0;
+}
+
+/*
+ * Map @n destination pixels, starting at @offset of a line scaled from @src
+ * to @scaled pixels, back to the source. Pixel centers are aligned so the
+ * image doesn't drift by half a pixel.
+ */
+static void _scale_taps(struct tap *taps, long n, long offset, long scaled,
+                        long src, enum ds_scale_filter filter)
+{
+    long i;
+
+    for (i = 0; i < n; i++) {
+        long long center = 2 * (i + offset) + 1;
+        long long pos;
+
+        if (filter == DS_SCALE_NEAREST) {
+            taps[i].idx = center * src / (2 * scaled);
+            taps[i].frac = 0;
+            continue;
+        }
+
+        pos = center * src * SCALE_ONE / (2 * scaled) - SCALE_ONE / 2;
+        pos = MAX(pos, 0);
+
+        taps[i].idx = pos >> SCALE_SHIFT;
+        taps[i].frac = pos & (SCALE_ONE - 1);
+
+        if (taps[i].idx >= src - 1) {
+            taps[i].idx = src - 1;
+            taps[i].frac = 0;
+        }
+    }
+}
+
+static inline unsigned char _lerp(unsigned int a, unsigned int b,
+                                  unsigned int f)
+{
+    return (a * (SCALE_ONE - f) + b * f + SCALE_ONE / 2) >> SCALE_SHIFT;
+}
+
+/* horizontal pass: resample one source row to @n pixels */
+static void _scale_row(struct color *dst, const struct color *src,
+                       const struct tap *taps, long n)
+{
+    long i;
+
+    for (i = 0; i < n; i++) {
+        const struct color *a = src + taps[i].idx;
+        unsigned int f = taps[i].frac;
+
+        if (!f) {
+            dst[i] = *a;
+            continue;
+        }
+
+        dst[i].red = _lerp(a[0].red, a[1].red, f);
+        dst[i].green = _lerp(a[0].green, a[1].green, f);
+        dst[i].blue = _lerp(a[0].blue, a[1].blue, f);
+    }
+}
+
+/*
+ * Vertical pass: blend two rows already scaled horizontally. Channels don't
+ * matter here, so rows are handled as plain bytes, 16 at a time when the
+ * target has SSE2 or NEON. @f is never 0 nor SCALE_ONE, so both weights
+ * fit in a byte.
+ */
+static void _blend_rows(unsigned char *dst, const unsigned char *a,
+                        const unsigned char *b, long len, unsigned int f)
+{
+    long i = 0;
+
+#if defined(ENABLE_SIMD) && defined(__SSE2__)
+    const __m128i wa = _mm_set1_epi16(SCALE_ONE - f);
+    const __m128i wb = _mm_set1_epi16(f);
+    const __m128i round = _mm_set1_epi16(SCALE_ONE / 2);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i lo, hi;
+
+        lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+                           _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+        hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+                           _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, round), SCALE_SHIFT);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, round), SCALE_SHIFT);
+
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#elif defined(ENABLE_SIMD) && defined(__ARM_NEON)
+    const uint8x8_t wa = vdup_n_u8(SCALE_ONE - f);
+    const uint8x8_t wb = vdup_n_u8(f);
+
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t va = vld1q_u8(a + i);
+        uint8x16_t vb = vld1q_u8(b + i);
+        uint16x8_t lo, hi;
+
+        lo = vmlal_u8(vmull_u8(vget_low_u8(va), wa), vget_low_u8(vb), wb);
+        hi = vmlal_u8(vmull_u8(vget_high_u8(va), wa), vget_high_u8(vb), wb);
+
+        vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, SCALE_SHIFT),
+                                      vrshrn_n_u16(hi, SCALE_SHIFT)));
+    }
+#endif
+
+    for (; i < len; i++)
+        dst[i] = _lerp(a[i], b[i], f);
+}
+
+struct scale_job {
+    const struct ds_fb *fb;
+    const struct image *img;
+    struct ds_surface *surface;
+    const struct tap *xtaps;
+    const struct tap *ytaps;
+};
+
+static int _scale_band(void *data, long start, long end)
+{
+    const struct scale_job *job = data;
+    const struct ds_fb *fb = job->fb;
+    const struct image *img = job->img;
+    struct ds_surface *surface = job->surface;
+    const struct tap *xtaps = job->xtaps, *ytaps = job->ytaps;
+    long w = surface->width, j;
+    long cached[2] = { -1, -1 };
+    struct color *rows, *row[2], *out;
+
+    rows = malloc(sizeof(*rows) * 3 * w);
+    if (!rows) {
+        err("allocating scaling buffers -- %m");
+        return -ENOMEM;
+    }
+
+    row[0] = rows;
+    row[1] = rows + w;
+    out = rows + 2 * w;
+
+    /*
+     * Each source row is scaled horizontally at most once: going down, the
+     * bottom row of one output line is usually the top row of the next.
+     */
+    for (j = start; j < end; j++) {
+        long y = ytaps[j].idx;
+        unsigned int f = ytaps[j].frac;
+        char *dst = surface->data + j * surface->stride;
+
+        if (cached[1] == y) {
+            struct color *tmp = row[0];
+
+            row[0] = row[1];
+            row[1] = tmp;
+            cached[1] = cached[0];
+            cached[0] = y;
+        }
+
+        if (cached[0] != y) {
+            _scale_row(row[0], img->pixels + y * img->width, xtaps, w);
+            cached[0] = y;
+        }
+
+        if (!f) {
+            fb->blit_row(fb, dst, row[0], w, j);
+            continue;
+        }
+
+        if (cached[1] != y + 1) {
+            _scale_row(row[1], img->pixels + (y + 1) * img->width, xtaps, w);
+            cached[1] = y + 1;
+        }
+
+        _blend_rows((unsigned char *) out, (const unsigned char *) row[0],
+                    (const unsigned char *) row[1], w * 3, f);
+        fb->blit_row(fb, dst, out, w, j);
+    }
+
+    free(rows);
+
+    return 0;
+}
+
+/**
+ * Compute in @w and @h the size an image of @w x @h pixels takes on @fb
+ * once scaled according to @mode, before any cropping
+ */
+void ds_scale_size(const struct ds_fb *fb, enum ds_scale_mode mode,
+                   long *w, long *h)
+{
+    long xres = fb->xres, yres = fb->yres;
+
+    switch (mode) {
+    case DS_SCALE_FIT:
+    case DS_SCALE_FILL:
+        /* fit follows the wider of image and screen, fill the other one */
+        if ((*w * yres > *h * xres) == (mode == DS_SCALE_FIT)) {
+            *h = MAX(*h * xres / *w, 1);
+            *w = xres;
+        } else {
+            *w = MAX(*w * yres / *h, 1);
+            *h = yres;
+        }
+        break;
+    case DS_SCALE_STRETCH:
+        *w = xres;
+        *h = yres;
+        break;
+    case DS_SCALE_NONE:
+        break;
+    }
+}
+
+/**
+ * Resample @img according to @mode and convert it to the pixel layout of
+ * @fb. The result never exceeds the screen: what doesn't fit in fill mode
+ * is cropped evenly from both sides and never computed.
+ *
+ * @return the new surface or NULL on allocation failure
+ */
+struct ds_surface *ds_surface_new_scaled(const struct ds_fb *fb,
+                                         const struct image *img,
+                                         enum ds_scale_mode mode,
+                                         enum ds_scale_filter filter)
+{
+    long xres = fb->xres, yres = fb->yres;
+    long sw = img->width, sh = img->height, w, h;
+    struct ds_surface *surface;
+    struct scale_job job;
+    struct tap *taps;
+    int ret;
+
+    ds_scale_size(fb, mode, &sw, &sh);
+
+    if (sw == img->width && sh == img->height)
+        return ds_surface_new_from_image(fb, img);
+
+    w = MIN(sw, xres);
+    h = MIN(sh, yres);
+
+    inf("scaling %ux%u image to %ldx%ld (%s, %s)", img->width, img->height,
+        sw, sh, _modes[mode], _filters[filter]);
+
+    surface = ds_surface_new(fb, w, h);
+    if (!surface)
+        return NULL;
+
+    taps = malloc(sizeof(*taps) * (w + h));
+    if (!taps) {
+        err("allocating scaling taps -- %m");
+        ds_surface_free(surface);
+        return NULL;
+    }
+
+    _scale_taps(taps, w, (sw - w) / 2, sw, img->width, filter);
+    _scale_taps(taps + w, h, (sh - h) / 2, sh, img->height, filter);
+
+    job.fb = fb;
+    job.img = img;
+    job.surface = surface;
+    job.xtaps = taps;
+    job.ytaps = taps + w;
+    ret = ds_band_run(h, w, _scale_band, &job);
+
+    free(taps);
+
+    if (ret < 0) {
+        ds_surface_free(surface);
+        return NULL;
+    }
+
+    return surface;
+}
@@ -0,0 +1,54 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * scale.h - resampling of images to the framebuffer resolution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#ifndef __DIETSPLASH_SCALE_H
+#define __DIETSPLASH_SCALE_H
+
+struct ds_fb;
+struct image;
+struct ds_surface;
+
+enum ds_scale_mode {
+    DS_SCALE_NONE = 0,  /* keep the image size, cropping if needed */
+    DS_SCALE_FIT,       /* largest size that shows the whole image */
+    DS_SCALE_FILL,      /* smallest size that covers the screen, cropped */
+    DS_SCALE_STRETCH,   /* exactly the screen size, ignoring aspect ratio */
+};
+
+enum ds_scale_filter {
+    DS_SCALE_BILINEAR = 0,
+    DS_SCALE_NEAREST,
+};
+
+int ds_scale_parse(const char *spec, enum ds_scale_mode *mode,
+                   enum ds_scale_filter *filter);
+void ds_scale_size(const struct ds_fb *fb, enum ds_scale_mode mode,
+                   long *w, long *h);
+struct ds_surface *ds_surface_new_scaled(const struct ds_fb *fb,
+                                         const struct image *img,
+                                         enum ds_scale_mode mode,
+                                         enum ds_scale_filter filter);
+
+#endif
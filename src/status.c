@@ -0,0 +1,303 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * status.c - message sent with the boot status, written on screen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+/*
+ * The message sent with dietsplashctl is written in a fixed size font that
+ * genstaticlogo built into the binary. Every glyph is expanded once, in the
+ * status colors and the screen format, into a single surface: writing a
+ * character is then copying its rows out of it, as the animation does with
+ * its frames. Glyphs are opaque cells, so the new text simply goes over the
+ * old one; only the part of the old text it doesn't cover is cleared, from
+ * a copy of what was on screen in the status area before any text, and
+ * nothing at all is drawn when the message is the one already shown.
+ */
+
+#include "log.h"
+#include "events.h"
+#include "fb.h"
+#include "pnmtologo.h"
+#include "progress.h"
+#include "status.h"
+#include "surface.h"
+#include "util.h"
+
+#include "status-font.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef STATUS_BG_COLOR
+#define STATUS_BG_COLOR BACKGROUND_COLOR
+#endif
+
+static const struct color _fg_color = {
+    (STATUS_COLOR >> 16) & 0xff,
+    (STATUS_COLOR >> 8) & 0xff,
+    STATUS_COLOR & 0xff,
+};
+
+static const struct color _bg_color = {
+    (STATUS_BG_COLOR >> 16) & 0xff,
+    (STATUS_BG_COLOR >> 8) & 0xff,
+    STATUS_BG_COLOR & 0xff,
+};
+
+static struct {
+    struct ds_fb *fb;
+    /* all glyphs side by side, in the order of the font */
+    struct ds_surface *glyphs;
+    /* where the text may go on screen, all on it */
+    struct ds_rect area;
+    /* what the area showed before any text */
+    struct ds_surface *under;
+    /* where the text shown is, inside area */
+    struct ds_rect text;
+    char msg[MAX_CMD_LEN + 1];
+} _status;
+
+/*
+ * By default a line as wide as the screen, right below the background, or
+ * the progress bar that goes there, or at the bottom of the screen if they
+ * reach it
+ */
+static void _status_area(const struct ds_fb *fb, struct ds_rect *area)
+{
+    const struct ds_rect *bg = &fb->bg_area;
+
+#ifdef STATUS_X
+    area->x = bg->x + STATUS_X;
+    area->y = bg->y + STATUS_Y;
+    area->w = STATUS_WIDTH;
+    area->h = STATUS_HEIGHT;
+#else
+    long top = bg->y + bg->h;
+#if defined(ENABLE_PROGRESS) && !defined(PROGRESS_X)
+    struct ds_rect bar;
+
+    ds_progress_area(fb, &bar);
+    top = MAX(top, bar.y + bar.h);
+#endif
+
+    area->x = 0;
+    area->w = fb->xres;
+    area->h = dietsplash_font.height;
+    area->y = MIN(top + area->h / 2, (long) fb->yres - area->h * 3 / 2);
+#if defined(ENABLE_PROGRESS) && !defined(PROGRESS_X)
+    /* no room below the bar, which is as low as it fits */
+    if (area->y < bar.y + bar.h)
+        area->y = bar.y - area->h * 3 / 2;
+#endif
+#endif
+}
+
+static struct ds_surface *_status_glyphs(const struct ds_fb *fb)
+{
+    const struct bitmap_font *font = &dietsplash_font;
+    unsigned int c, x, y, pitch = (font->width + 7) / 8;
+    struct ds_surface *glyphs;
+    struct image *img;
+
+    img = malloc(sizeof(*img) + sizeof(struct color) * font->n_glyphs *
+                 font->width * font->height);
+    if (!img) {
+        err("allocating glyphs -- %m");
+        return NULL;
+    }
+
+    img->width = font->n_glyphs * font->width;
+    img->height = font->height;
+
+    for (c = 0; c < font->n_glyphs; c++) {
+        for (y = 0; y < font->height; y++) {
+            const unsigned char *bits = font->bits +
+                                        (c * font->height + y) * pitch;
+            struct color *dst = img->pixels + y * img->width +
+                                c * font->width;
+
+            for (x = 0; x < font->width; x++)
+                dst[x] = (bits[x / 8] >> (7 - x % 8)) & 1 ?
+                         _fg_color : _bg_color;
+        }
+    }
+
+    glyphs = ds_surface_new_from_image(fb, img);
+    free(img);
+
+    return glyphs;
+}
+
+/* copy what's on screen in @area, to be put back where text is cleared */
+static struct ds_surface *_status_under(const struct ds_fb *fb,
+                                        const struct ds_rect *area)
+{
+    struct ds_surface *under;
+    long j;
+
+    under = ds_surface_new(fb, area->w, area->h);
+    if (!under)
+        return NULL;
+
+    for (j = 0; j < area->h; j++)
+        memcpy(under->data + j * under->stride,
+               ds_fb_pixel(fb, area->x, area->y + j), under->stride);
+
+    return under;
+}
+
+/**
+ * Convert the glyphs of the font for @fb. Nothing is drawn until there is
+ * a message. Must be called after the background is drawn: what's then in
+ * the status area is what shows again where text is cleared.
+ *
+ * @return 0 on success or -1 on error
+ */
+int ds_status_start(struct ds_fb *fb)
+{
+    const struct bitmap_font *font = &dietsplash_font;
+    struct ds_rect *area = &_status.area;
+    long x2, y2;
+
+    assert(fb);
+
+    _status_area(fb, area);
+    x2 = MIN(area->x + area->w, (long) fb->xres);
+    y2 = MIN(area->y + area->h, (long) fb->yres);
+    area->x = MAX(area->x, 0);
+    area->y = MAX(area->y, 0);
+    area->w = x2 - area->x;
+    area->h = y2 - area->y;
+
+    inf("status message in %ldx%ld at %ld,%ld", area->w, area->h, area->x,
+        area->y);
+
+    if (area->w < (long) font->width || area->h < (long) font->height) {
+        wrn("status area on screen can't hold a %ux%u character",
+            font->width, font->height);
+        return -1;
+    }
+
+    _status.glyphs = _status_glyphs(fb);
+    if (!_status.glyphs)
+        return -1;
+
+    _status.under = _status_under(fb, area);
+    if (!_status.under) {
+        ds_surface_free(_status.glyphs);
+        _status.glyphs = NULL;
+        return -1;
+    }
+
+    _status.fb = fb;
+    _status.msg[0] = '\0';
+    _status.text = *area;
+    _status.text.w = 0;
+
+    return 0;
+}
+
+/*
+ * @pos rounded down to the grid of dithering formats, so cells match the
+ * fills by them, or up if that's before @start. Left as is if @size from
+ * there would end past @end.
+ */
+static long _status_grid(long pos, long size, long start, long end)
+{
+    long p = pos & ~3L;
+
+    if (p < start)
+        p += 4;
+
+    return p + size <= end ? p : pos;
+}
+
+/* put back what was under the text in columns @x to @x + @w of it */
+static void _status_clear(const struct ds_rect *text, long x, long w)
+{
+    struct ds_rect rect = {
+        x - _status.area.x, text->y - _status.area.y, w, text->h
+    };
+
+    ds_fb_draw_surface_rect(_status.fb, _status.under, &rect, x, text->y);
+}
+
+/**
+ * Show @msg, centered in the status area and cut to what fits in it
+ */
+void ds_status_set(const char *msg)
+{
+    const struct bitmap_font *font = &dietsplash_font;
+    const struct ds_rect *area = &_status.area;
+    const struct ds_rect *old = &_status.text;
+    struct ds_rect text, glyph = { 0, 0, font->width, font->height };
+    long i, len;
+
+    /* messages from events.c may fill MAX_CMD_LEN without a terminator */
+    if (!_status.fb || !strncmp(msg, _status.msg, MAX_CMD_LEN))
+        return;
+
+    snprintf(_status.msg, sizeof(_status.msg), "%.*s", MAX_CMD_LEN, msg);
+
+    len = MIN((long) strlen(_status.msg), area->w / (long) font->width);
+    text.w = len * font->width;
+    text.h = font->height;
+    text.x = _status_grid(area->x + (area->w - text.w) / 2, text.w, area->x,
+                          area->x + area->w);
+    text.y = _status_grid(area->y + (area->h - text.h) / 2, text.h, area->y,
+                          area->y + area->h);
+
+    for (i = 0; i < len; i++) {
+        unsigned int c = (unsigned char) _status.msg[i];
+
+        if (c < font->first || c >= font->first + font->n_glyphs)
+            c = '?';
+
+        glyph.x = (c - font->first) * font->width;
+        ds_fb_draw_surface_rect(_status.fb, _status.glyphs, &glyph,
+                                text.x + i * font->width, text.y);
+    }
+
+    /* what's left of the old text on either side */
+    if (text.x > old->x)
+        _status_clear(old, old->x, MIN(text.x, old->x + old->w) - old->x);
+    if (text.x + text.w < old->x + old->w) {
+        long x = MAX(text.x + text.w, old->x);
+
+        _status_clear(old, x, old->x + old->w - x);
+    }
+
+    _status.text = text;
+    ds_fb_flush(_status.fb);
+}
+
+void ds_status_stop(void)
+{
+    ds_surface_free(_status.glyphs);
+    _status.glyphs = NULL;
+    ds_surface_free(_status.under);
+    _status.under = NULL;
+    _status.fb = NULL;
+}
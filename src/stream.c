@@ -0,0 +1,257 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * stream.c - draw images while they are decoded
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "log.h"
+#include "band.h"
+#include "fb.h"
+#include "pnmtologo.h"
+#include "stream.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#endif
+
+/*
+ * Images are decoded STREAM_ROWS rows at a time, each window converted to
+ * the screen right after. With more than one CPU a thread decodes ahead,
+ * at most STREAM_SLOTS windows, while the caller converts, so reading the
+ * file, decoding and converting overlap. Memory used is that of the
+ * windows, whatever the size of the image.
+ */
+#define STREAM_ROWS 8
+#define STREAM_SLOTS 4
+
+struct stream_job {
+    struct ds_fb *fb;
+    struct ds_image_stream *stream;
+    struct color *slots;
+    long n_slots;
+    unsigned int width;
+    long rows;          /* visible ones, nothing past them is decoded */
+    long w;
+    char *dst;
+    long windows;
+#ifdef ENABLE_THREADS
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    long decoded;
+    long drawn;
+    int ret;
+#endif
+};
+
+static inline struct color *_stream_slot(const struct stream_job *job, long i)
+{
+    return job->slots + (i % job->n_slots) * STREAM_ROWS * job->width;
+}
+
+static inline long _stream_window_rows(const struct stream_job *job, long i)
+{
+    return MIN(STREAM_ROWS, job->rows - i * STREAM_ROWS);
+}
+
+static void _stream_draw_window(const struct stream_job *job, long i)
+{
+    const struct ds_fb *fb = job->fb;
+    const struct color *src = _stream_slot(job, i);
+    long j, y = i * STREAM_ROWS, n = _stream_window_rows(job, i);
+    char *dst = job->dst + y * fb->stride;
+
+    for (j = 0; j < n; j++, dst += fb->stride, src += job->width)
+        fb->blit_row(fb, dst, src, job->w, y + j);
+}
+
+#ifdef ENABLE_THREADS
+static void *_stream_decode_thread(void *arg)
+{
+    struct stream_job *job = arg;
+    long i;
+    int ret;
+
+    for (i = 0; i < job->windows; i++) {
+        pthread_mutex_lock(&job->lock);
+        while (i - job->drawn >= job->n_slots)
+            pthread_cond_wait(&job->cond, &job->lock);
+        pthread_mutex_unlock(&job->lock);
+
+        ret = ds_image_stream_read(job->stream, _stream_slot(job, i),
+                                   _stream_window_rows(job, i));
+
+        pthread_mutex_lock(&job->lock);
+        if (ret < 0)
+            job->ret = ret;
+        else
+            job->decoded = i + 1;
+        pthread_cond_broadcast(&job->cond);
+        pthread_mutex_unlock(&job->lock);
+
+        if (ret < 0)
+            break;
+    }
+
+    return NULL;
+}
+
+/*
+ * Convert windows as the decoding thread hands them over
+ *
+ * @return 0 on success, a negative errno if decoding failed or 1 if the
+ * thread couldn't be started and nothing was done
+ */
+static int _stream_run_threaded(struct stream_job *job)
+{
+    sigset_t all, old;
+    pthread_t thread;
+    bool ready;
+    long i;
+    int ret;
+
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->cond, NULL);
+    job->decoded = job->drawn = 0;
+    job->ret = 0;
+
+    /* as with bands, signals keep going to the main thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    ret = pthread_create(&thread, NULL, _stream_decode_thread, job);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (ret) {
+        dbg("starting decoding thread -- %s", strerror(ret));
+        ret = 1;
+        goto out;
+    }
+
+    for (i = 0; i < job->windows; i++) {
+        pthread_mutex_lock(&job->lock);
+        while (job->decoded <= i && !job->ret)
+            pthread_cond_wait(&job->cond, &job->lock);
+        ready = job->decoded > i;
+        pthread_mutex_unlock(&job->lock);
+
+        if (!ready)
+            break;
+
+        _stream_draw_window(job, i);
+
+        pthread_mutex_lock(&job->lock);
+        job->drawn = i + 1;
+        pthread_cond_broadcast(&job->cond);
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    pthread_join(thread, NULL);
+    ret = job->ret;
+
+out:
+    pthread_cond_destroy(&job->cond);
+    pthread_mutex_destroy(&job->lock);
+
+    return ret;
+}
+#endif
+
+static int _stream_run(struct stream_job *job)
+{
+    long i;
+    int ret;
+
+    for (i = 0; i < job->windows; i++) {
+        ret = ds_image_stream_read(job->stream, _stream_slot(job, i),
+                                   _stream_window_rows(job, i));
+        if (ret < 0)
+            return ret;
+
+        _stream_draw_window(job, i);
+    }
+
+    return 0;
+}
+
+/**
+ * Decode @stream and draw it on @fb as it goes, placed and cropped as
+ * ds_fb_draw_surface() would. Rows below the screen are never decoded.
+ *
+ * @return 0 on success or a negative errno. If decoding fails midway, the
+ * rows before the error are on screen.
+ */
+int ds_fb_draw_stream(struct ds_fb *fb, struct ds_image_stream *stream,
+                      float xalign, float yalign)
+{
+    struct stream_job job;
+    unsigned int width, height;
+    long xoffset, yoffset;
+    int ret = 1;
+
+    assert(fb);
+    assert(stream);
+
+    ds_image_stream_size(stream, &width, &height);
+
+    job.fb = fb;
+    job.stream = stream;
+    job.width = width;
+    job.w = MIN((long) width, (long) fb->xres);
+    job.rows = MIN((long) height, (long) fb->yres);
+    job.windows = (job.rows + STREAM_ROWS - 1) / STREAM_ROWS;
+
+    xoffset = (long)((fb->xres - job.w) * xalign);
+    yoffset = (long)((fb->yres - job.rows) * yalign);
+    job.dst = ds_fb_pixel(fb, xoffset, yoffset);
+
+    job.n_slots = 1;
+    if (ds_band_cpus() > 1 && job.windows > 1)
+        job.n_slots = STREAM_SLOTS;
+
+    job.slots = malloc(sizeof(struct color) * job.n_slots * STREAM_ROWS *
+                       width);
+    if (!job.slots) {
+        err("allocating stream rows -- %m");
+        return -ENOMEM;
+    }
+
+#ifdef ENABLE_THREADS
+    if (job.n_slots > 1)
+        ret = _stream_run_threaded(&job);
+#endif
+
+    /* a single slot is enough when decoding and converting take turns */
+    if (ret > 0)
+        ret = _stream_run(&job);
+
+    free(job.slots);
+
+    ds_fb_damage(fb, xoffset, yoffset, job.w, job.rows);
+
+    return ret;
+}
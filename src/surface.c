@@ -0,0 +1,405 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * surface.c - images stored in the framebuffer's native pixel format
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "log.h"
+#include "band.h"
+#include "fb.h"
+#include "pnmtologo.h"
+#include "rle.h"
+#include "surface.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Allocate an uninitialized surface with the same pixel layout as @fb
+ *
+ * @return the new surface or NULL on allocation failure
+ */
+struct ds_surface *ds_surface_new(const struct ds_fb *fb, unsigned int width,
+                                  unsigned int height)
+{
+    struct ds_surface *surface;
+    int bytes_per_pixel = fb->bits_per_pixel / 8;
+    size_t stride = (size_t) width * bytes_per_pixel;
+
+    /* sizes come from image headers and cache files, don't let them wrap */
+    if (stride / bytes_per_pixel != width || stride > LONG_MAX ||
+        (height && stride > (SIZE_MAX - sizeof(*surface)) / height)) {
+        errno = ENOMEM;
+        err("%ux%u surface is too large", width, height);
+        return NULL;
+    }
+
+    surface = malloc(sizeof(*surface) + stride * height);
+    if (!surface) {
+        err("allocating %ux%u surface -- %m", width, height);
+        return NULL;
+    }
+
+    surface->width = width;
+    surface->height = height;
+    surface->stride = stride;
+    surface->bytes_per_pixel = bytes_per_pixel;
+
+    return surface;
+}
+
+struct convert_job {
+    const struct ds_fb *fb;
+    const struct image *img;
+    struct ds_surface *surface;
+};
+
+static int _surface_convert_band(void *data, long start, long end)
+{
+    const struct convert_job *job = data;
+    const struct ds_fb *fb = job->fb;
+    const struct image *img = job->img;
+    struct ds_surface *surface = job->surface;
+    long j;
+
+    for (j = start; j < end; j++)
+        fb->blit_row(fb, surface->data + j * surface->stride,
+                     img->pixels + j * img->width, img->width, j);
+
+    return 0;
+}
+
+/**
+ * Convert @img to the pixel layout of @fb. This is the only place where
+ * the conversion cost is paid: any later draw is a copy.
+ *
+ * @return the new surface or NULL on allocation failure
+ */
+struct ds_surface *ds_surface_new_from_image(const struct ds_fb *fb,
+                                             const struct image *img)
+{
+    struct convert_job job;
+
+    job.surface = ds_surface_new(fb, img->width, img->height);
+    if (!job.surface)
+        return NULL;
+
+    job.fb = fb;
+    job.img = img;
+    ds_band_run(img->height, img->width, _surface_convert_band, &job);
+
+    return job.surface;
+}
+
+struct indexed_convert_job {
+    const struct indexed_image *img;
+    const struct ds_blit_palette *palette;
+    struct ds_surface *surface;
+};
+
+static int _surface_convert_indexed_band(void *data, long start, long end)
+{
+    const struct indexed_convert_job *job = data;
+    const struct indexed_image *img = job->img;
+    struct ds_surface *surface = job->surface;
+    long j;
+
+    for (j = start; j < end; j++)
+        ds_blit_indexed_row(job->palette, surface->data + j * surface->stride,
+                            img->pixels + j * img->width, img->width, j);
+
+    return 0;
+}
+
+/**
+ * Convert @img to the pixel layout of @fb, a lookup per pixel in its
+ * palette converted once. If @fb is pseudocolor with that same palette,
+ * pixels are copied as they are.
+ *
+ * @return the new surface or NULL on allocation failure
+ */
+struct ds_surface *ds_surface_new_from_indexed(const struct ds_fb *fb,
+                                               const struct indexed_image *img)
+{
+    struct indexed_convert_job job;
+    struct ds_blit_palette *palette;
+
+    palette = malloc(sizeof(*palette));
+    if (!palette) {
+        err("allocating palette -- %m");
+        return NULL;
+    }
+
+    job.surface = ds_surface_new(fb, img->width, img->height);
+    if (job.surface) {
+        ds_blit_palette_init(fb, img->palette, img->colors, palette);
+        job.img = img;
+        job.palette = palette;
+        ds_band_run(img->height, img->width, _surface_convert_indexed_band,
+                    &job);
+    }
+
+    free(palette);
+
+    return job.surface;
+}
+
+/**
+ * Turn @surface, holding pixels in @format, back into an RGB image. Used
+ * when pixels were converted ahead of time for a screen that turned out to
+ * be different.
+ *
+ * @return the image, to be released with free(), or NULL with errno set
+ */
+struct image *ds_surface_to_image(const struct ds_surface *surface,
+                                  enum ds_fb_format format)
+{
+    struct ds_fb fb = { .format = format };
+    struct image *img;
+    unsigned int j;
+
+    if (ds_blit_format_fill(&fb, format) < 0 ||
+        fb.bits_per_pixel / 8 != surface->bytes_per_pixel) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    img = malloc(sizeof(*img) +
+                 (size_t) surface->width * surface->height *
+                 sizeof(struct color));
+    if (!img)
+        return NULL;
+
+    img->width = surface->width;
+    img->height = surface->height;
+
+    for (j = 0; j < surface->height; j++)
+        ds_blit_unpack_row(&fb, img->pixels + (size_t) j * img->width,
+                           surface->data + j * surface->stride,
+                           surface->width);
+
+    return img;
+}
+
+/*
+ * Runs become fills with the color converted once per row, literals are
+ * converted straight from the encoded data. Both are dithered by where
+ * they are in the row, so the result is the same as converting it whole.
+ */
+static int _surface_decode_rle(const struct ds_fb *fb,
+                               struct ds_surface *surface, struct ds_rle *rle)
+{
+    unsigned char pattern[DS_BLIT_PATTERN_LEN];
+    struct ds_rle_packet packet;
+    struct color color;
+    long x = 0, y = 0, pattern_x = -1, pattern_y = -1;
+    long w = surface->width, h = surface->height;
+    int bpp = surface->bytes_per_pixel;
+    int ret;
+
+    while (y < h) {
+        const struct color *src;
+        unsigned long count;
+
+        ret = ds_rle_next(rle, &packet);
+        if (ret <= 0)
+            return -EINVAL;
+
+        src = packet.pixels;
+        for (count = packet.count; count && y < h;) {
+            long n = MIN(count, (unsigned long)(w - x));
+            char *dst = surface->data + y * surface->stride + x * bpp;
+
+            if (!packet.run) {
+                ds_blit_row_at(fb, dst, src, n, x, y);
+                src += n;
+            } else {
+                if (pattern_y != y || pattern_x != (x & 3) ||
+                    memcmp(&color, src, sizeof(color))) {
+                    color = *src;
+                    pattern_x = x & 3;
+                    pattern_y = y;
+                    ds_blit_pattern(fb, &color, x, y, pattern);
+                }
+                ds_blit_fill_row(dst, pattern, n * bpp);
+            }
+
+            count -= n;
+            x += n;
+            if (x == w) {
+                x = 0;
+                y++;
+            }
+        }
+
+        if (count)
+            return -EINVAL;
+    }
+
+    return 0;
+}
+
+/**
+ * Expand the RLE image held in the @size bytes at @data into a surface,
+ * without ever holding the whole image as RGB. The more the image
+ * compresses, the faster this goes.
+ *
+ * @return the new surface, or NULL if @data is not a valid RLE image
+ */
+struct ds_surface *ds_surface_new_from_rle_data(const struct ds_fb *fb,
+                                                const void *data, size_t size)
+{
+    struct ds_surface *surface;
+    struct ds_rle rle;
+
+    if (ds_rle_init(&rle, data, size) < 0)
+        return NULL;
+
+    surface = ds_surface_new(fb, rle.width, rle.height);
+    if (!surface)
+        return NULL;
+
+    if (_surface_decode_rle(fb, surface, &rle) < 0) {
+        ds_surface_free(surface);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return surface;
+}
+
+/**
+ * Same as ds_surface_new_from_rle_data(), for the RLE image in @filename
+ */
+struct ds_surface *ds_surface_new_from_rle(const struct ds_fb *fb,
+                                           const char *filename)
+{
+    struct ds_surface *surface;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) < 0 || st.st_size < DS_RLE_HEADER_SIZE) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    surface = ds_surface_new_from_rle_data(fb, map, st.st_size);
+    if (!surface && errno == EINVAL)
+        err("%s: bad RLE data", filename);
+
+    munmap(map, st.st_size);
+
+    return surface;
+}
+
+void ds_surface_free(struct ds_surface *surface)
+{
+    free(surface);
+}
+
+void ds_fb_draw_surface(struct ds_fb *fb, const struct ds_surface *surface,
+                        float xalign, float yalign)
+{
+    long xoffset, yoffset;
+    long w = surface->width;
+    long h = surface->height;
+
+    assert(fb);
+    assert(surface);
+
+    if (fb->xres < w) {
+        wrn("fb xres (%d) is less than surface size (%ld)", fb->xres, w);
+        w = fb->xres;
+    }
+
+    if (fb->yres < h) {
+        wrn("fb yres (%d) is less than surface size (%ld)", fb->yres, h);
+        h = fb->yres;
+    }
+
+    xoffset = (long)((fb->xres - w) * xalign);
+    yoffset = (long)((fb->yres - h) * yalign);
+
+    ds_fb_draw_surface_at(fb, surface, xoffset, yoffset);
+}
+
+/**
+ * Draw @surface with its top left corner at (@x, @y), which may be off
+ * screen. Only the part inside the screen is copied.
+ */
+void ds_fb_draw_surface_at(struct ds_fb *fb, const struct ds_surface *surface,
+                           long x, long y)
+{
+    struct ds_rect rect = { 0, 0, surface->width, surface->height };
+
+    ds_fb_draw_surface_rect(fb, surface, &rect, x, y);
+}
+
+/**
+ * Same as ds_fb_draw_surface_at(), for the @rect part of @surface only
+ */
+void ds_fb_draw_surface_rect(struct ds_fb *fb, const struct ds_surface *surface,
+                             const struct ds_rect *rect, long x, long y)
+{
+    long j, len;
+    long x1 = MAX(x, 0), y1 = MAX(y, 0);
+    long x2 = MIN(x + rect->w, (long) fb->xres);
+    long y2 = MIN(y + rect->h, (long) fb->yres);
+    const char *src;
+    char *dst;
+
+    assert(surface->bytes_per_pixel == fb->bits_per_pixel / 8);
+    assert(rect->x + rect->w <= (long) surface->width &&
+           rect->y + rect->h <= (long) surface->height);
+
+    if (x1 >= x2 || y1 >= y2)
+        return;
+
+    dst = ds_fb_pixel(fb, x1, y1);
+    src = surface->data + (rect->y + y1 - y) * surface->stride +
+          (rect->x + x1 - x) * surface->bytes_per_pixel;
+    len = (x2 - x1) * surface->bytes_per_pixel;
+
+    for (j = y1; j < y2; j++, dst += fb->stride, src += surface->stride)
+        memcpy(dst, src, len);
+
+    ds_fb_damage(fb, x1, y1, x2 - x1, y2 - y1);
+}
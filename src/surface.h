@@ -0,0 +1,71 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * surface.h - images stored in the framebuffer's native pixel format
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#ifndef __DIETSPLASH_SURFACE_H
+#define __DIETSPLASH_SURFACE_H
+
+#include "blit.h"
+
+#include <stddef.h>
+
+struct ds_fb;
+struct ds_rect;
+struct image;
+struct indexed_image;
+
+/*
+ * Pixels already converted to the layout of a given framebuffer, so drawing
+ * is a plain copy of each line
+ */
+struct ds_surface {
+    unsigned int width;
+    unsigned int height;
+    long stride;
+    int bytes_per_pixel;
+    char data[];
+};
+
+struct ds_surface *ds_surface_new(const struct ds_fb *fb, unsigned int width,
+                                  unsigned int height);
+struct ds_surface *ds_surface_new_from_image(const struct ds_fb *fb,
+                                             const struct image *img);
+struct ds_surface *ds_surface_new_from_indexed(const struct ds_fb *fb,
+                                               const struct indexed_image *img);
+struct ds_surface *ds_surface_new_from_rle_data(const struct ds_fb *fb,
+                                                const void *data, size_t size);
+struct ds_surface *ds_surface_new_from_rle(const struct ds_fb *fb,
+                                           const char *filename);
+struct image *ds_surface_to_image(const struct ds_surface *surface,
+                                  enum ds_fb_format format);
+void ds_surface_free(struct ds_surface *surface);
+
+void ds_fb_draw_surface(struct ds_fb *fb, const struct ds_surface *surface,
+                        float xalign, float yalign);
+void ds_fb_draw_surface_at(struct ds_fb *fb, const struct ds_surface *surface,
+                           long x, long y);
+void ds_fb_draw_surface_rect(struct ds_fb *fb, const struct ds_surface *surface,
+                             const struct ds_rect *rect, long x, long y);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ *
+ * dietsplash
+ *
+ * Copyright (C) 2010 ProFUSION embedded systems
+ *
+ * test-blit.c - check vectorized row conversion against the scalar one
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "blit.h"
+#include "fb.h"
+#include "pnmtologo.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Every vectorized routine this CPU can run converts random rows of every
+ * width up to past the longest vector loop, and a few large odd ones, at
+ * each row of the dither matrix. Output must be the same as the scalar
+ * routine's, byte for byte, and nothing may be written past the row. Rows
+ * are allocated to their exact size, so reading past them shows up under
+ * a memory checker.
+ */
+
+/* automake's code for a skipped test */
+#define TEST_SKIP 77
+#define GUARD 64
+
+static const long _large_widths[] = { 255, 1001, 1023, 1921, 3839 };
+
+static int _check(const struct ds_blit_kernel *kernel, long n, long y)
+{
+    struct ds_fb fb;
+    ds_blit_row_func scalar;
+    struct color *src;
+    unsigned char *want, *got;
+    long i, len;
+    int ret = 0;
+
+    memset(&fb, 0, sizeof(fb));
+    ds_blit_format_fill(&fb, kernel->format);
+    scalar = ds_blit_scalar_row_func_get(&fb);
+    len = n * (fb.bits_per_pixel / 8);
+
+    src = malloc(n * sizeof(*src));
+    want = malloc(len + GUARD);
+    got = malloc(len + GUARD);
+    if (!src || !want || !got) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < n; i++) {
+        src[i].red = rand();
+        src[i].green = rand();
+        src[i].blue = rand();
+    }
+
+    memset(want, 0xa5, len + GUARD);
+    memset(got, 0xa5, len + GUARD);
+    scalar(&fb, (char *) want, src, n, y);
+    kernel->func(&fb, (char *) got, src, n, y);
+
+    if (memcmp(want, got, len)) {
+        for (i = 0; want[i] == got[i]; i++)
+            ;
+        fprintf(stderr, "%s %s: width %ld row %ld differs at byte %ld\n",
+                kernel->name, ds_blit_format_name(kernel->format), n, y, i);
+        ret = -1;
+    } else if (memcmp(want + len, got + len, GUARD)) {
+        fprintf(stderr, "%s %s: width %ld row %ld writes past the row\n",
+                kernel->name, ds_blit_format_name(kernel->format), n, y);
+        ret = -1;
+    }
+
+    free(src);
+    free(want);
+    free(got);
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    const struct ds_blit_kernel *kernels;
+    unsigned int k, n, tested = 0;
+    int failed = 0;
+    long w, y;
+
+    srand(1);
+    kernels = ds_blit_simd_kernels(&n);
+
+    for (k = 0; k < n; k++) {
+        int bad = 0;
+
+        if (!kernels[k].supported()) {
+            printf("SKIP %s %s\n", kernels[k].name,
+                   ds_blit_format_name(kernels[k].format));
+            continue;
+        }
+
+        for (y = 0; y < 4; y++) {
+            for (w = 1; w <= 67; w++)
+                bad |= _check(&kernels[k], w, y);
+            for (w = 0; w < (long) ARRAY_SIZE(_large_widths); w++)
+                bad |= _check(&kernels[k], _large_widths[w], y);
+        }
+
+        printf("%s %s %s\n", bad ? "FAIL" : "PASS", kernels[k].name,
+               ds_blit_format_name(kernels[k].format));
+        failed |= bad;
+        tested++;
+    }
+
+    if (!tested)
+        return TEST_SKIP;
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
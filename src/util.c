@@ -49,6 +49,36 @@ void _die(const char *fmt, ...)
     exit(1);
 }
 
+/**
+ * Hash of the @size bytes at @data. Not meant to resist anyone crafting
+ * collisions, only to notice an image changed: 8 bytes per step keeps it
+ * well below the cost of a conversion. They're taken as little endian, so
+ * the same bytes hash the same on any host.
+ */
+uint64_t ds_hash(const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    const uint64_t k = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = size * k, w;
+    size_t i;
+
+    for (i = 0; i + 8 <= size; i += 8) {
+        memcpy(&w, p + i, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        w = __builtin_bswap64(w);
+#endif
+        h = (h ^ w) * k;
+        h ^= h >> 29;
+    }
+
+    for (; i < size; i++) {
+        h = (h ^ p[i]) * k;
+        h ^= h >> 29;
+    }
+
+    return h;
+}
+
 static int _devtmpfs_mounted;
 
 /**
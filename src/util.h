@@ -26,6 +26,9 @@
 #ifndef __DIETSPLASH_UTIL_H
 #define __DIETSPLASH_UTIL_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 /**
  * BUILD_ASSERT_OR_ZERO - assert a build-time dependency, as an expression.
  * @cond: the compile-time condition which must be true.
@@ -60,6 +63,9 @@
  */
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]) + _array_size_chk(arr))
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
 
 #define DIE_PREFIX "[" PACKAGE_NAME "] ERR: "
 #define LOG_SUFFIX "\n"
@@ -68,6 +74,8 @@ void _die(const char *fmt, ...)  __attribute__((noreturn)) __attribute__((format
 #define die(x, ...) \
     _die(DIE_PREFIX x LOG_SUFFIX, ## __VA_ARGS__)
 
+uint64_t ds_hash(const void *data, size_t size);
+
 int ds_fs_setup(const char *dev);
 int ds_fs_shutdown(void);
 